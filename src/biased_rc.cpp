@@ -0,0 +1,155 @@
+#include "biased_rc.hpp"
+#include "dynamic_rc.hpp"
+
+#include <iostream>
+
+
+//所有スレッド毎の情報(所有者番号の下位ビット - 1 をインデックスとする)と、終了したスレッドから引き継げるもの、そのロック
+SpinLock biased_owner_records_lock{};
+vector<BiasedOwnerRecord*> biased_owner_records{};
+vector<BiasedOwnerRecord*> free_biased_owner_records{};
+
+
+/**
+ * 所有者番号に対応する情報を取得
+ * 情報が引き継がれている場合もあるため、所有スレッドが生存しているかどうかは owner_id と比べて判断する
+ */
+inline BiasedOwnerRecord* get_biased_owner_record(uint32_t thread_id) {
+    biased_owner_records_lock.lock();
+    auto* record = biased_owner_records[(thread_id & BIASED_OWNER_INDEX_MASK) - 1];
+    biased_owner_records_lock.unlock();
+    return record;
+}
+
+
+/**
+ * 同時に生存するスレッドが BIASED_OWNER_MAX_RECORDS を超えた場合にプロセスを終了させる
+ */
+[[noreturn]] void fail_too_many_biased_owners() {
+    cerr << "get_biased_thread_id: more than " << BIASED_OWNER_MAX_RECORDS << " threads hold an owner id" << endl;
+    abort();
+}
+
+
+/**
+ * スレッドの終了時に待ち行列を全て処理し、所有スレッドが終了したことを記録する
+ */
+struct BiasedOwnerGuard {
+    BiasedOwnerRecord* record = nullptr;
+
+    ~BiasedOwnerGuard() {
+        if (this->record == nullptr) {
+            return;
+        }
+
+        while (true) {
+            flush_biased_decrements();
+
+            //待ち行列が空である場合のみ終了を記録する
+            this->record->lock.lock();
+            if (this->record->pending_decrements.empty()) {
+                this->record->is_alive = false;
+                this->record->lock.unlock();
+                break;
+            }
+            this->record->lock.unlock();
+        }
+
+        //再利用した回数が上限に達していなければ、新しく起動したスレッドが引き継げるようにする
+        if ((this->record->owner_id >> BIASED_OWNER_INDEX_BITS) < BIASED_OWNER_MAX_REUSE) {
+            biased_owner_records_lock.lock();
+            free_biased_owner_records.push_back(this->record);
+            biased_owner_records_lock.unlock();
+        }
+
+        current_biased_thread_id = 0;
+        current_biased_owner_record = nullptr;
+    }
+};
+
+thread_local BiasedOwnerGuard biased_owner_guard;
+
+
+/**
+ * 現在のスレッドの所有者番号を取得する(未割り当てであれば割り当てる)
+ */
+uint32_t get_biased_thread_id() {
+    if (current_biased_thread_id != 0) {
+        return current_biased_thread_id;
+    }
+
+    //終了後も他のスレッドから参照されるため、一度作成したら破棄せず、終了したスレッドのものがあれば引き継ぐ
+    BiasedOwnerRecord* record;
+    uint32_t thread_id;
+
+    biased_owner_records_lock.lock();
+    if (!free_biased_owner_records.empty()) {
+        record = free_biased_owner_records.back();
+        free_biased_owner_records.pop_back();
+        biased_owner_records_lock.unlock();
+
+        //再利用した回数を進めるため、以前の所有スレッドの番号を持つオブジェクトは終了したスレッドのものとしてマージされる
+        record->lock.lock();
+        thread_id = record->owner_id + (1u << BIASED_OWNER_INDEX_BITS);
+        record->owner_id = thread_id;
+        record->is_alive = true;
+        record->lock.unlock();
+    } else {
+        if (biased_owner_records.size() >= BIASED_OWNER_MAX_RECORDS) [[unlikely]] {
+            biased_owner_records_lock.unlock();
+            fail_too_many_biased_owners();
+        }
+        record = new BiasedOwnerRecord();
+        biased_owner_records.push_back(record);
+        thread_id = (uint32_t) biased_owner_records.size();
+        record->owner_id = thread_id;
+        biased_owner_records_lock.unlock();
+    }
+
+    biased_owner_guard.record = record;
+    current_biased_owner_record = record;
+    current_biased_thread_id = thread_id;
+    return thread_id;
+}
+
+
+/**
+ * オブジェクトの所有スレッドの待ち行列へ参照カウントの減算を積む
+ * 所有スレッドが既に終了している場合は積まずに false を返す
+ */
+bool defer_biased_decrement(HeapObject* object) {
+    auto owner_id = object->load_biased_owner_id();
+    auto* record = get_biased_owner_record(owner_id);
+
+    record->lock.lock();
+    auto is_alive = record->is_alive && record->owner_id == owner_id;
+    if (is_alive) {
+        record->pending_decrements.push_back(object);
+        record->has_pending_decrements.store(true, memory_order_relaxed);
+    }
+    record->lock.unlock();
+
+    return is_alive;
+}
+
+
+/**
+ * 現在のスレッドの待ち行列に積まれた減算を全て処理する
+ */
+void flush_biased_decrements() {
+    auto* record = current_biased_owner_record;
+    if (record == nullptr) {
+        return;
+    }
+
+    vector<HeapObject*> pending_decrements;
+    record->lock.lock();
+    pending_decrements.swap(record->pending_decrements);
+    record->has_pending_decrements.store(false, memory_order_relaxed);
+    record->lock.unlock();
+
+    //所有スレッド上で参照を手放すことで biased_count から減らす
+    for (auto* object : pending_decrements) {
+        DynamicRC rc(object);
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+
+#include "spin_lock.hpp"
+
+using namespace std;
+
+
+class HeapObject;
+
+
+/**
+ * >>> Biased Reference Counting
+ *
+ * 複数のスレッドで共有されるオブジェクトであっても、実際にはほとんどのアクセスが一つのスレッドに偏っていることが多い。
+ * この場合に mutex 化したオブジェクトの参照カウントを全て atomic-read-modify-write で操作するのは無駄が大きいため、
+ * オブジェクトを共有したスレッドを所有スレッドとし、所有スレッドは通常の命令で操作する biased_count を、
+ * それ以外のスレッドは atomic な命令で操作する共有カウント(reference_count)を使用する。
+ * 実際の参照カウントは biased_count と共有カウントの和となる。
+ *
+ *  1. 所有スレッドは biased_count を通常の命令で増減させる
+ *     biased_count が0になった場合は biased モードを解除し(マージ)、以降は通常の mutex オブジェクトとして振る舞う
+ *
+ *  2. 所有スレッド以外は共有カウントを atomic な命令で増減させる
+ *     共有カウントが0である時に減らそうとした場合(所有スレッドが数えた参照を手放す場合)は、
+ *     減らす代わりに所有スレッドの待ち行列へ積み、所有スレッドが biased_count から減らす
+ *
+ *     所有スレッドは、オブジェクトを割り当てる度とエポックを付けて退避したオブジェクトを記録する度に待ち行列を確認し、積まれていれば処理する
+ *     (一度の確認は、待ち行列が空でないことを表すフラグの load のみである)
+ *
+ *  3. 所有スレッドは終了時に待ち行列を全て処理してから終了を記録する
+ *     終了した所有スレッドの biased_count はそれ以降変更されないため、
+ *     待ち行列へ積もうとしたスレッドが代わりに biased_count を共有カウントへマージする
+ *
+ * biased モードは enable_biased_rc(true) を呼び出したスレッドが to_mutex によりオブジェクトを共有する場合と、
+ * そのスレッドが割り当てたオブジェクトが遅延して共有されたことを記録する場合にのみ使用される。
+ * 循環性のある型は循環参照コレクタとの整合性のため biased モードを使用しない。
+ */
+
+
+//所有者番号の下位ビットは所有スレッド毎の情報の番号(1 から始まる)、上位ビットはその情報を再利用した回数とする
+//終了したスレッドの情報を新しいスレッドが引き継いでも所有者番号は変わるため、終了したスレッドの番号を持つオブジェクトは
+//新しいスレッドの biased モードや local_stamp と取り違えられず、マージされる
+//同時に生存できるスレッドは BIASED_OWNER_MAX_RECORDS 個までであり、再利用した回数が上限に達した情報は以降再利用しない
+#define BIASED_OWNER_INDEX_BITS 16
+#define BIASED_OWNER_INDEX_MASK ((1u << BIASED_OWNER_INDEX_BITS) - 1)
+#define BIASED_OWNER_MAX_RECORDS BIASED_OWNER_INDEX_MASK
+#define BIASED_OWNER_MAX_REUSE ((1u << (32 - BIASED_OWNER_INDEX_BITS)) - 1)
+
+//現在のスレッドの所有者番号(0 は未割り当て)
+inline thread_local uint32_t current_biased_thread_id = 0;
+
+//現在のスレッドが共有するオブジェクトに biased モードを使用するかどうか
+inline thread_local bool biased_rc_enabled = false;
+
+
+/**
+ * 所有スレッド毎の情報
+ * スレッドの終了後も他のスレッドから参照されるため破棄せず、新しく所有者番号を割り当てるスレッドが引き継ぐ
+ */
+struct BiasedOwnerRecord {
+    SpinLock lock;
+    //所有スレッドが生存しているかどうか
+    bool is_alive = true;
+    //現在の所有スレッドの所有者番号(引き継ぐ度に上位ビットが変わる)
+    uint32_t owner_id = 0;
+    //所有スレッドが biased_count から減らすべきオブジェクトの待ち行列
+    vector<HeapObject*> pending_decrements;
+    //待ち行列が空でないかどうか(所有スレッドがロックを取らずに確認する)
+    atomic<bool> has_pending_decrements{false};
+};
+
+
+//現在のスレッドの情報(所有者番号が未割り当てであれば nullptr)
+inline thread_local BiasedOwnerRecord* current_biased_owner_record = nullptr;
+
+
+/**
+ * 現在のスレッドの所有者番号を取得する(未割り当てであれば割り当てる)
+ * 終了したスレッドの情報があれば、再利用した回数を進めて引き継ぐ
+ */
+uint32_t get_biased_thread_id();
+
+/**
+ * 現在のスレッドが共有するオブジェクトに biased モードを使用するかどうかを切り替える
+ */
+inline void enable_biased_rc(bool is_enabled) {
+    biased_rc_enabled = is_enabled;
+}
+
+/**
+ * オブジェクトの所有スレッドの待ち行列へ参照カウントの減算を積む
+ * 所有スレッドが既に終了している場合(情報が他のスレッドに引き継がれている場合を含む)は積まずに false を返す
+ */
+bool defer_biased_decrement(HeapObject* object);
+
+/**
+ * 現在のスレッドの待ち行列に積まれた減算を全て処理する
+ */
+void flush_biased_decrements();
+
+/**
+ * 現在のスレッドの待ち行列に減算が積まれていれば全て処理する
+ * 所有スレッドが長く生存していても、他のスレッドが手放したオブジェクトが解放されずに残り続けないよう定期的に呼び出す
+ */
+inline void poll_biased_decrements() {
+    auto* record = current_biased_owner_record;
+    if (record != nullptr && record->has_pending_decrements.load(memory_order_relaxed)) [[unlikely]] {
+        flush_biased_decrements();
+    }
+}
@@ -1,16 +1,417 @@
 #include "cycle_collector.hpp"
 #include "dynamic_rc.hpp"
 #include <utility>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <barrier>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 
-SpinLock list_lock{};
-unordered_set<HeapObject*> suspected_object_set{};
+//全てのスレッドのバッファと、終了したスレッドから引き継げるもの
+SpinLock suspect_buffers_lock{};
+vector<SuspectBuffer*> suspect_buffers{};
+vector<SuspectBuffer*> free_suspect_buffers{};
+
+//前回の回収で初めて調べ、解放できなかったルートオブジェクトのスタック(gc_lock の下でのみ操作する)
+HeapObject* remaining_roots = SUSPECT_LIST_END;
+
+//二回以上の回収で解放できなかった古いルートオブジェクトのスタック(gc_lock の下でのみ操作する)
+//生存し続ける循環参照を毎回辿らないように、old_roots_interval 回の回収に一度だけ調べる
+HeapObject* old_roots = SUSPECT_LIST_END;
+
+//古いルートオブジェクトを調べる間隔と、次に調べるまでの回収の回数(gc_lock の下でのみ操作する)
+size_t old_roots_interval = 1;
+size_t collections_until_old_roots = 0;
+
+//古いルートオブジェクトを調べる間隔の上限
+#define GC_OLD_ROOTS_MAX_INTERVAL 64
+
+//解放可能と判定したが、まだいずれかのバッファに残っているため解放を遅らせているオブジェクト(gc_lock の下でのみ操作する)
+unordered_set<HeapObject*> deferred_release_objects{};
+
+//gc_collect_step / gc_collect_for で打ち切られたため、まだ調べていないルートオブジェクト(gc_lock の下でのみ操作する)
+//次の回収で、バッファから取り出すよりも先に調べる
+vector<HeapObject*> pending_roots{};
+
+//pending_roots の先頭から何個が、以前の回収を生き延びたルートオブジェクトであるか(gc_lock の下でのみ操作する)
+size_t number_of_pending_aged = 0;
+
+//調べ終えていないルートオブジェクトに古いルートオブジェクトが含まれるかどうかと、
+//その中で以前の回収を生き延びたルートオブジェクトを解放できたかどうか(gc_lock の下でのみ操作する)
+bool is_old_roots_pending = false;
+bool is_pending_aged_root_released = false;
+
+//古いルートオブジェクトを調べる回収で、辿るオブジェクトの上限に掛ける倍率(gc_lock の下でのみ操作する)
+//上限を超えた古いルートオブジェクトが残る度に倍にし、上限を超えずに調べ終えれば1に戻す
+//これにより、上限を超える大きさの循環参照もゴミになれば、上限に対する大きさの対数回の古いルートオブジェクトの回収で回収される
+size_t old_roots_trace_limit_scale = 1;
+
+//調べ終えていない古いルートオブジェクトを含む回収で、辿るオブジェクトが上限を超えたかどうか(gc_lock の下でのみ操作する)
+bool is_old_roots_limit_hit = false;
+
+
+/**
+ * ルートオブジェクトが生存しているという判定
+ *
+ * 循環参照がゴミになるのは、その中のいずれかのオブジェクトへの最後の外部からの参照が外された時である。
+ * そのオブジェクトは参照カウントが2以上あったため、ルートオブジェクトとして記録されているか、減らす前にバッファへ積まれている。
+ * 判定した部分グラフのフィールドが変更されていなければ(load_live_epoch の値が進んでいなければ)内部からの参照は増えないため、
+ * 外部からの参照が外されたルートオブジェクトは参照カウントが判定した時点よりも減っている。
+ * よって、参照カウントが変わっておらず世代も進んでいないルートオブジェクトを辿らなくても、ゴミになった循環参照は他のルートオブジェクトから見つかる。
+ */
+struct LiveVerdict {
+    //判定した時点の参照カウント
+    size_t ref_count;
+    //判定した時点の load_live_epoch の値
+    uint64_t epoch;
+};
+
+atomic<uint64_t> gc_live_epoch{0};
+
+/**
+ * 生存しているという判定の現在の世代を読む
+ * gc_live_epoch と各バッファの number_of_live_invalidations はいずれも増える一方であるため、合計が変わっていなければどれも進んでいない
+ */
+uint64_t load_live_epoch() {
+    auto live_epoch = gc_live_epoch.load(memory_order_seq_cst);
+
+    //終了したスレッドのバッファも一覧に残っている
+    suspect_buffers_lock.lock();
+    for (auto* buffer : suspect_buffers) {
+        live_epoch += buffer->number_of_live_invalidations.load(memory_order_seq_cst);
+    }
+    suspect_buffers_lock.unlock();
+
+    return live_epoch;
+}
+
+//以前の回収で生存していると判定したルートオブジェクト(gc_lock の下でのみ操作する)
+unordered_map<HeapObject*, LiveVerdict> live_verdicts{};
+
+
+/**
+ * 一度の回収の結果
+ */
+struct CollectionResult {
+    //調べたルートオブジェクトの数
+    size_t number_of_roots = 0;
+    //解放したオブジェクトの数
+    size_t number_of_released = 0;
+    //まだ調べていないルートオブジェクトが残っていないかどうか
+    bool is_finished = true;
+};
+
+
+//ロックを取らずに辿るかどうか(gc_lock の下でのみ操作する)
+bool concurrent_detection = false;
+
+//循環参照の判定方法(gc_lock の下でのみ操作する)
+cycle_detection_engine detection_engine = cycle_detection_engine::trial_deletion;
+
+//一つのルートオブジェクトから新たに辿るオブジェクトの数とバイト数の上限(gc_lock の下でのみ操作する。0 は上限なし)
+size_t trace_limit_objects = 0;
+size_t trace_limit_bytes = 0;
+
+atomic<suspect_trigger> current_suspect_trigger{suspect_trigger::increment_to_shared};
+
+//コレクタ側で数える統計情報(バッファへ積まれた数は各バッファが数える)
+atomic_size_t number_of_traced_roots{0};
+atomic_size_t number_of_wasted_traces{0};
+atomic_size_t number_of_skipped_roots{0};
+atomic_size_t number_of_cached_roots{0};
+atomic_size_t number_of_released_objects{0};
+atomic_size_t number_of_trace_limit_hits{0};
+atomic_size_t number_of_abandoned_objects{0};
+
+
+//並列に回収する際に、ワーカーが一度に取り出して調べるルートオブジェクトの数
+#define GC_WORKER_CHUNK_SIZE 64
+
+//並列に回収する際に、一つのワーカーが一つのルートオブジェクトから辿るオブジェクトの数の上限
+//超えた場合は、全てのワーカーで共同して辿るために後回しにする
+#define GC_WORKER_TRACE_LIMIT 16384
+
+//共同して辿る際に、作業用のスタックがこの数を超えれば半分を他のワーカーが盗めるように公開する
+#define GC_SHARED_STACK_THRESHOLD 64
+
+
+/**
+ * 強連結成分に分解する際の、オブジェクト毎の作業用の情報
+ * 辿る間に何度も参照するため、一つのキャッシュラインに収まるよう一つにまとめる
+ */
+struct SccNode {
+    //そこから辿れる Tarjan のスタック上のオブジェクトの最小の番号(オブジェクトは訪れた順に番号で表す)
+    uint32_t lowlink;
+    //属する成分の番号(Tarjan のスタック上にある間は UINT32_MAX)
+    uint32_t component;
+    //部分グラフの内側からの参照の数
+    uint32_t internal_count;
+    //訪れた時点で読んだ参照カウント(UINT32_MAX を超えるものは UINT32_MAX)
+    uint32_t ref_count;
+};
+
+
+/**
+ * 回収を行うワーカー毎の作業用の情報
+ * 確保した領域は回収をまたいで再利用する
+ */
+struct CollectorWorker {
+    //ワーカーの番号(0 は gc_collect を呼び出したスレッド)
+    size_t worker_id = 0;
+    //他のワーカーと同時に回収しているかどうか
+    bool is_parallel = false;
+    //ロックを取らずに辿り、後から検証するかどうか(set_concurrent_detection を参照)
+    bool is_concurrent = false;
+    //一つのルートオブジェクトから新たに辿るオブジェクトの数とバイト数の上限(上限なしは SIZE_MAX)
+    size_t max_trace_objects = SIZE_MAX;
+    size_t max_trace_bytes = SIZE_MAX;
+    //各フェーズで辿るオブジェクトを積む作業用のスタック
+    //深い構造を辿ってもスレッドのスタックを使い切らないように、再帰呼び出しの代わりに使用する
+    vector<HeapObject*> mark_stack;
+    //探索したオブジェクトのリスト
+    vector<HeapObject*> collect_objects;
+    //ヘッダに格納できないオブジェクトのカウント
+    //並列に回収している場合は、ヘッダに格納できないオブジェクトを着色したのが自身であるかどうかの判定にも使用する
+    unordered_map<HeapObject*, size_t> count_map;
+    //調べているルートオブジェクトのうち、mark red phase を終えたもの
+    vector<HeapObject*> marked_roots;
+    //白にマークしたオブジェクト
+    vector<HeapObject*> release_objects;
+    //他のワーカーが探索中のオブジェクトに行き当たったか、辿るオブジェクトが多すぎたため、単独では調べなかったルートオブジェクト
+    //ロックを取らずに辿った場合は、検証に失敗したルートオブジェクト
+    vector<HeapObject*> contended_roots;
+    //辿るオブジェクトが上限を超えたため、打ち切って後回しにするルートオブジェクト
+    vector<HeapObject*> limited_roots;
+    //今回の回収で上限を超えたルートオブジェクトから辿ったオブジェクト
+    //同じ大きな構造を多くのルートオブジェクトから辿り直さないように、これらに行き当たったルートオブジェクトも直ちに打ち切る
+    unordered_set<HeapObject*> over_limit_objects;
+    //ロックを取らずに辿った場合に、mark gray phase で読んだ参照カウント(検証しないものは SIZE_MAX)
+    unordered_map<HeapObject*, size_t> observed_counts;
+    //mark gray phase で参照カウントを読んだルートオブジェクトとして記録されているオブジェクトと、その値(検証しないものは SIZE_MAX)
+    vector<pair<HeapObject*, size_t>> buffered_ref_counts;
+    //辿ったルートオブジェクトとして記録されているオブジェクトの新しい判定(回収の終わりに live_verdicts へ移す)
+    //ref_count が SIZE_MAX のものは、生存していると判定できなかったため以前の判定を破棄する
+    vector<pair<HeapObject*, LiveVerdict>> live_verdicts;
+    //強連結成分に分解する際に訪れたオブジェクトと、その作業用の情報(どちらも訪れた順に並べる)
+    vector<HeapObject*> scc_objects;
+    vector<SccNode> scc_nodes;
+    //Tarjan のスタックと、探索中のオブジェクトと次に調べるフィールドの番号
+    vector<uint32_t> scc_stack;
+    vector<pair<uint32_t, uint32_t>> scc_frames;
+    //異なる成分の間の参照(参照元のオブジェクトと参照先の成分)と、それを参照元の成分毎に並べたもの
+    vector<pair<uint32_t, uint32_t>> scc_edges;
+    vector<uint32_t> scc_edge_begins;
+    vector<uint32_t> scc_edge_targets;
+    //各成分が生存しているかどうか
+    vector<bool> scc_is_live;
+    //担当するルートオブジェクトの範囲(他のワーカーが盗む場合もこのワーカーの next_root を進める)
+    atomic<size_t> next_root{0};
+    size_t end_root = 0;
+    //共同して辿る際に、他のワーカーが盗めるように公開した作業
+    SpinLock shared_stack_lock;
+    vector<HeapObject*> shared_stack;
+    atomic<size_t> shared_stack_size{0};
+};
+
+
+/**
+ * ワーカーが実行する処理
+ */
+using CollectorJob = void (*)(CollectorWorker& worker, vector<HeapObject*>& trial_roots, size_t number_of_workers);
+
+
+/**
+ * 並列に回収する際に gc_collect を呼び出したスレッドを手伝うスレッドの待ち合わせ
+ */
+struct CollectorPool {
+    mutex pool_mutex;
+    condition_variable start_condition;
+    condition_variable finish_condition;
+    //開始した回収の通し番号
+    uint64_t generation = 0;
+    //回収に参加するワーカー数(gc_collect を呼び出したスレッドを含む)
+    size_t number_of_workers = 0;
+    //まだ作業を終えていない手伝うスレッドの数
+    size_t number_of_running = 0;
+    //実行する処理と、調べるルートオブジェクト
+    CollectorJob job = nullptr;
+    vector<HeapObject*>* trial_roots = nullptr;
+};
+
+//手伝うスレッドはプロセスの終了時にも待機したままとなるため、どちらも破棄しない
+auto* collector_pool = new CollectorPool();
+//ワーカー毎の作業用の情報(gc_lock の下でのみ追加する)
+auto* collector_workers = new vector<CollectorWorker*>();
+
+
+/**
+ * 各フェーズの終わりで、次に辿るフェーズのために作業を持っているワーカーの数を戻す
+ */
+struct ResetActiveWorkers {
+    void operator()() noexcept;
+};
+
+/**
+ * 全てのワーカーで共同してルートオブジェクトを調べる際の待ち合わせ(gc_lock の下でのみ使用する)
+ */
+struct SharedCollection {
+    //各フェーズの終わりで全てのワーカーを待ち合わせる
+    barrier<ResetActiveWorkers>* phase_barrier = nullptr;
+    //参加しているワーカーの数
+    size_t number_of_workers = 0;
+    //作業を持っているワーカーの数(0 になれば全てのワーカーが辿り終えている)
+    atomic<size_t> number_of_active{0};
+};
+
+SharedCollection shared_collection{};
+
+void ResetActiveWorkers::operator()() noexcept {
+    shared_collection.number_of_active.store(shared_collection.number_of_workers, memory_order_relaxed);
+}
+
+
+/**
+ * スレッドの終了時にバッファを他のスレッドが引き継げるようにする
+ */
+struct SuspectBufferGuard {
+    SuspectBuffer* buffer = nullptr;
+
+    ~SuspectBufferGuard() {
+        if (this->buffer == nullptr) {
+            return;
+        }
+
+        suspect_buffers_lock.lock();
+        free_suspect_buffers.push_back(this->buffer);
+        suspect_buffers_lock.unlock();
+
+        current_suspect_buffer = nullptr;
+    }
+};
+
+thread_local SuspectBufferGuard suspect_buffer_guard;
+
+
+SuspectBuffer* init_suspect_buffer() {
+    SuspectBuffer* buffer;
+
+    suspect_buffers_lock.lock();
+    if (!free_suspect_buffers.empty()) {
+        buffer = free_suspect_buffers.back();
+        free_suspect_buffers.pop_back();
+    } else {
+        buffer = new SuspectBuffer();
+        suspect_buffers.push_back(buffer);
+    }
+    suspect_buffers_lock.unlock();
+
+    suspect_buffer_guard.buffer = buffer;
+    current_suspect_buffer = buffer;
+    return buffer;
+}
+
+
+/**
+ * スタックに積まれたオブジェクトを全てルートの集合(unordered_set 若しくは vector)へ移す
+ */
+template<typename T> void take_suspect_list(HeapObject* object, T& roots) {
+    while (object != SUSPECT_LIST_END) {
+        auto* next = object->get_suspect_next();
+        //取り出した後は suspect_next の領域をコレクタの作業用に使用できる
+        object->set_gc_root(true);
+        roots.insert(roots.end(), object);
+        object = next;
+    }
+}
+
+
+/**
+ * 以前の回収を生き延びたルートオブジェクトを取り出す
+ * 古いルートオブジェクトは、is_full が true であるか調べる回数になった場合のみ取り出し、取り出したかどうかを返す
+ */
+bool take_aged_roots(vector<HeapObject*>& aged_roots, bool is_full) {
+    take_suspect_list(remaining_roots, aged_roots);
+    remaining_roots = SUSPECT_LIST_END;
+
+    if (!is_full && collections_until_old_roots != 0) {
+        collections_until_old_roots--;
+        return false;
+    }
+    take_suspect_list(old_roots, aged_roots);
+    old_roots = SUSPECT_LIST_END;
+    return true;
+}
+
+
+/**
+ * 全てのスレッドのバッファから、前回以降に積まれたオブジェクトを取り出す
+ */
+void drain_suspect_buffers(unordered_set<HeapObject*>& roots) {
+    //バッファの一覧を取得する間のみロックする(実行スレッドの追記は止めない)
+    suspect_buffers_lock.lock();
+    auto buffers = suspect_buffers;
+    suspect_buffers_lock.unlock();
+
+    for (auto* buffer : buffers) {
+        //先頭を交換してスタック全体を一度に取り出す
+        auto* head = buffer->head.exchange(SUSPECT_LIST_END, memory_order_acquire);
+        take_suspect_list(head, roots);
+    }
+}
+
+
+/**
+ * フィールドにオブジェクトを一つも持たないかどうか
+ * そのようなオブジェクトは循環参照の一部になり得ないため、ルートオブジェクトとして調べずに残しておける
+ * 参照カウントが1に戻っただけでは、各オブジェクトが前のオブジェクトからのみ参照される循環リストを除外できないため判定に使用しない
+ * 調べた後に実行スレッドがフィールドへ格納した場合も、ルートオブジェクトとして残るため次の回収で改めて判定される
+ */
+bool has_no_field_objects(HeapObject* object) {
+    auto** fields = (HeapObject**) (object + 1);
+    size_t field_length = object->get_field_length();
+    for (size_t i = 0; i < field_length; i++) {
+        if (((atomic<HeapObject*>*) &fields[i])->load(memory_order_relaxed) != nullptr) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * set_trace_limit で設定した上限に倍率を掛けた、ワーカーの上限を返す(0 は上限なし)
+ */
+size_t scale_trace_limit(size_t trace_limit, size_t scale) {
+    if (trace_limit == 0 || trace_limit > SIZE_MAX / scale) {
+        return SIZE_MAX;
+    }
+    return trace_limit * scale;
+}
+
+
+/**
+ * 以前の回収で生存していると判定したルートオブジェクトの判定が、まだ有効であるかどうか
+ * live_epoch は今回の回収を始めた時点の load_live_epoch の値
+ */
+bool has_valid_live_verdict(HeapObject* root, uint64_t live_epoch) {
+    auto it = live_verdicts.find(root);
+    if (it == live_verdicts.end()) {
+        return false;
+    }
+    return it->second.epoch == live_epoch && root->load_ref_count() == it->second.ref_count;
+}
 
 
 /**
  * オブジェクトに着色する色
  */
 enum object_color : uint8_t {
+    none,
     red,
     gray,
     white,
@@ -18,35 +419,1006 @@ enum object_color : uint8_t {
 };
 
 
-/**
- * ルートオブジェクトとそれに連なる全てのオブジェクトを、ロックを取得しながら赤に着色する
- */
-void mark_red(HeapObject* root, HeapObject* current_object, unordered_map<HeapObject*, uint8_t>& color_map, vector<HeapObject*>& collect_objects, bool& is_cyclic_root);
+/**
+ * mark red phase でルートオブジェクトから辿った結果
+ */
+enum mark_red_result : uint8_t {
+    //全て辿った
+    marked,
+    //他のワーカーが探索中のオブジェクトに行き当たったか、並列に回収する際に一つのワーカーで辿るには多すぎた
+    contended,
+    //新たに辿ったオブジェクトが上限を超えた(set_trace_limit を参照)
+    over_trace_limit
+};
+
+
+/**
+ * ルートオブジェクトとそれに連なる全てのオブジェクトを、ロックを取得しながら赤に着色する
+ * 並列に回収している場合、他のワーカーが探索中のオブジェクトに行き当たるか、辿るオブジェクトが多すぎれば contended を返す
+ * 新たに辿ったオブジェクトの数かバイト数がワーカーの上限を超えれば、その時点で打ち切って over_trace_limit を返す
+ */
+mark_red_result mark_red(HeapObject* root, CollectorWorker& worker);
+
+/**
+ * Mark gray phase
+ * Partial mark and sweep と同様
+ */
+void mark_gray(HeapObject* root, CollectorWorker& worker);
+
+/**
+ * Mark white phase
+ * Partial mark and sweep と同様
+ */
+void mark_white(HeapObject* root, CollectorWorker& worker);
+
+/**
+ * Mark black phase
+ * Partial mark and sweep と同様 (ただしカウントの変更は行わない)
+ */
+void mark_black(HeapObject* root, CollectorWorker& worker);
+
+/**
+ * mark red phase で辿った部分グラフを強連結成分に分解し、解放できる成分のオブジェクトを白に、それ以外を黒に着色する
+ */
+void mark_strongly_connected_components(CollectorWorker& worker);
+
+/**
+ * 回収可能かどうかをチェック
+ */
+bool check_ready_to_collect(HeapObject* root, unordered_set<HeapObject*>& acyclic_objects, vector<HeapObject*>& mark_stack);
+
+
+/**
+ * 試行削除後のカウントを読み書きする
+ * mark red の時点で local_stamp の領域を使用できると判定したオブジェクトはヘッダに、それ以外のみ count_map に格納する
+ */
+inline size_t load_trial_count(HeapObject* object, unordered_map<HeapObject*, size_t>& count_map) {
+    if (object->has_gc_scratch()) {
+        return object->load_gc_scratch();
+    }
+    return count_map[object];
+}
+
+inline void store_trial_count(HeapObject* object, size_t count, unordered_map<HeapObject*, size_t>& count_map) {
+    if (object->has_gc_scratch()) {
+        object->store_gc_scratch(count);
+    } else {
+        count_map[object] = count;
+    }
+}
+
+/**
+ * オブジェクトの全てのフィールドのオブジェクトを作業用のスタックに積む
+ */
+inline void push_field_objects(HeapObject* object, vector<HeapObject*>& stack) {
+    //オブジェクトの開始ポインタ
+    auto** field_start_ptr = (HeapObject**) (object + 1);
+    size_t field_length = object->get_field_length();
+
+    for (size_t i = 0; i < field_length; i++) {
+        //ロックを取らずに辿る場合に、実行スレッドによるフィールドの変更の記録と順序付けられるよう seq_cst でロードする
+        auto* field_object = ((atomic<HeapObject*>*) &field_start_ptr[i])->load(memory_order_seq_cst);
+
+        if (field_object != nullptr) {
+            stack.push_back(field_object);
+        }
+    }
+}
+
+
+/**
+ * 着色済みのオブジェクトを着色したのが、並列に回収しているワーカー自身であるかどうか
+ * mark red phase の間は、ヘッダに格納できるオブジェクトにはカウントの代わりにワーカーの番号 + 1 を格納しておく
+ * 他のワーカーは自身の番号を格納しないため、同時に書き換えられていても誤って一致することはない
+ */
+inline bool is_marked_by(HeapObject* object, CollectorWorker& worker) {
+    if (object->has_gc_scratch()) {
+        return object->load_gc_scratch() == worker.worker_id + 1;
+    }
+    return worker.count_map.find(object) != worker.count_map.end();
+}
+
+SpinLock gc_lock{};
+
+
+/**
+ * 探索したオブジェクトのうち、begin 番目以降のもののヘッダに格納した作業用の情報を消去し、ロックを解除する
+ */
+void clear_collect_objects(CollectorWorker& worker, size_t begin) {
+    auto& collect_objects = worker.collect_objects;
+    for (size_t i = begin; i < collect_objects.size(); i++) {
+        auto* object = collect_objects[i];
+        if (object->has_gc_scratch()) {
+            object->clear_gc_scratch();
+            object->set_has_gc_scratch(false);
+        } else if (begin != 0) {
+            worker.count_map.erase(object);
+        }
+        object->set_gc_color(object_color::none);
+        if (worker.is_concurrent) {
+            object->clear_gc_dirty();
+        } else {
+            object->unlock();
+        }
+    }
+
+    //確保した領域は次の回収で再利用する
+    collect_objects.resize(begin);
+    if (begin == 0) {
+        worker.count_map.clear();
+        worker.observed_counts.clear();
+    }
+}
+
+
+/**
+ * ロックを取らずに辿ったオブジェクトが、辿っている間に変更されていないかを検証する
+ *
+ * 試行削除は、辿った範囲の外からの参照が無いオブジェクトを白にする。ロックを取らない場合、実行スレッドは
+ * コレクタが参照カウントを読んだ後のオブジェクトへの参照を、まだ読んでいないオブジェクトから移すことができるため、
+ * 次の二つを確かめ、どちらかが成り立たなければ判定を破棄する。
+ *
+ *  1. mark gray phase で読んだ参照カウントが変わっていない
+ *     参照を得た実行スレッドがそれを保持しているか範囲の外のフィールドへ移していれば、参照カウントが増えている
+ *
+ *  2. 着色している間にフィールドが変更されていない(mark_gc_dirty_if_traced)
+ *     1. の増加は、辿った範囲の内側の参照を外して減らさない限り打ち消されない。
+ *     実行スレッドは外したオブジェクトの参照カウントを減らす前に変更を記録するため、打ち消された参照カウントを読んだ後には記録が見える
+ */
+bool validate_concurrent_trace(CollectorWorker& worker) {
+    for (auto& [object, observed_count] : worker.observed_counts) {
+        if (observed_count != SIZE_MAX && object->load_ref_count() != observed_count) {
+            return false;
+        }
+    }
+
+    //読んだ参照カウントを減らした実行スレッドによる記録を取得
+    atomic_thread_fence(memory_order_acquire);
+
+    for (auto* object : worker.collect_objects) {
+        if (object->is_gc_dirty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * 与えられたルートオブジェクトをまとめて調べ、白にマークしたオブジェクトを worker.release_objects へ追加する(MarkRoots, ScanRoots, CollectRoots)
+ * 複数のルートオブジェクトから辿れるオブジェクトも、それぞれのフェーズにつき一度だけ訪れる
+ * 辿ったオブジェクトの数を返す
+ */
+size_t collect_roots(CollectorWorker& worker, HeapObject** roots, size_t number_of_roots) {
+    worker.marked_roots.clear();
+    //後回しにしたルートオブジェクトから辿り、元に戻したオブジェクトの数
+    size_t number_of_abandoned = 0;
+
+    //辿り始める前の世代を読み、辿っている間にフィールドが変更されていれば判定を無効にする
+    auto live_epoch = load_live_epoch();
+
+    //Mark red phase
+    //全てのルートオブジェクトからロックを掛けつつ辿りながら、赤に着色する
+    for (size_t i = 0; i < number_of_roots; i++) {
+        auto* root = roots[i];
+        auto begin = worker.collect_objects.size();
+        auto result = mark_red(root, worker);
+        if (result == mark_red_result::marked) {
+            worker.marked_roots.push_back(root);
+            continue;
+        }
+
+        //他のワーカーと競合したか辿るオブジェクトが多すぎた場合は、このルートオブジェクトから新たに辿った分のみを元に戻して後回しにする
+        number_of_abandoned += worker.collect_objects.size() - begin;
+        if (result == mark_red_result::over_trace_limit) {
+            number_of_trace_limit_hits.fetch_add(1, memory_order_relaxed);
+            number_of_abandoned_objects.fetch_add(worker.collect_objects.size() - begin, memory_order_relaxed);
+            worker.over_limit_objects.insert(worker.collect_objects.begin() + (ptrdiff_t) begin, worker.collect_objects.end());
+            worker.limited_roots.push_back(root);
+        } else {
+            worker.contended_roots.push_back(root);
+        }
+        clear_collect_objects(worker, begin);
+    }
+
+    if (detection_engine == cycle_detection_engine::strongly_connected_components) {
+        //辿った部分グラフを強連結成分に分解し、成分毎に白か黒に着色する
+        mark_strongly_connected_components(worker);
+    } else {
+        //Mark gray phase
+        //Partial mark and sweep と同様
+        //他のルートオブジェクトから辿られて既に灰色であれば、その参照分は既に差し引かれている
+        for (auto* root : worker.marked_roots) {
+            if (root->get_gc_color() == object_color::red) {
+                mark_gray(root, worker);
+            }
+        }
+
+        //Mark white or black phase
+        //Partial mark and sweep と同様
+        for (auto* root : worker.marked_roots) {
+            mark_white(root, worker);
+        }
+    }
+
+    //ロックを取らずに辿った場合、判定の間に変更されていれば何も解放せずに後回しにする
+    if (worker.is_concurrent && !validate_concurrent_trace(worker)) {
+        worker.contended_roots.insert(worker.contended_roots.end(), worker.marked_roots.begin(), worker.marked_roots.end());
+        //辿ったルートオブジェクトの以前の判定は、もう正しいとは限らない
+        worker.buffered_ref_counts.clear();
+        gc_live_epoch.fetch_add(1, memory_order_seq_cst);
+        auto number_of_traced = worker.collect_objects.size() + number_of_abandoned;
+        clear_collect_objects(worker, 0);
+        return number_of_traced;
+    }
+
+    //辿ったルートオブジェクト(今回取り出していないものを含む)の判定を、今回の結果で置き換える
+    //黒にマークしたものは参照カウントを読んだ時点で生存していたものとして記録し、白にマークしたものは解放する際に破棄する
+    for (auto [object, ref_count] : worker.buffered_ref_counts) {
+        if (object->get_gc_color() == object_color::black) {
+            worker.live_verdicts.emplace_back(object, LiveVerdict{ref_count, live_epoch});
+        }
+    }
+    worker.buffered_ref_counts.clear();
+
+    //白にマークしたオブジェクトを開放可能なオブジェクトとしてマーク
+    for (auto* object : worker.collect_objects) {
+        if (object->get_gc_color() == object_color::white) {
+            object->mark_ready_to_release_with_gc();
+            worker.release_objects.push_back(object);
+        }
+    }
+
+    //作業用の情報を消去し、取得したロックを全て解除
+    auto number_of_traced = worker.collect_objects.size() + number_of_abandoned;
+    clear_collect_objects(worker, 0);
+
+    return number_of_traced;
+}
+
+
+/**
+ * 実行スレッド上で参照カウントが0になったルートオブジェクトから辿れるオブジェクトが全て開放可能としてマークされていれば、
+ * それらを release_objects へ追加する
+ * 辿ったオブジェクトの数を返す
+ */
+size_t collect_acyclic_root(HeapObject* root, unordered_set<HeapObject*>& release_objects, vector<HeapObject*>& mark_stack) {
+    //実行スレッド上で開放可能としてマークされているかどうかをチェック
+    unordered_set<HeapObject*> acyclic_objects;
+    bool ready_to_release = check_ready_to_collect(root, acyclic_objects, mark_stack);
+
+    //マークされている場合は開放可能として記憶
+    if (ready_to_release) {
+        for (auto& object : acyclic_objects) {
+            release_objects.insert(object);
+        }
+    }
+
+    return acyclic_objects.size();
+}
+
+
+/**
+ * 並列に回収するワーカーの処理
+ * 自身の範囲のルートオブジェクトを調べ終えたら、他のワーカーの範囲から盗んで調べる
+ */
+void run_collector_worker(CollectorWorker& worker, vector<HeapObject*>& trial_roots, size_t number_of_workers) {
+    for (size_t i = 0; i < number_of_workers; i++) {
+        auto& victim = *(*collector_workers)[(worker.worker_id + i) % number_of_workers];
+        while (true) {
+            auto begin = victim.next_root.fetch_add(GC_WORKER_CHUNK_SIZE, memory_order_relaxed);
+            if (begin >= victim.end_root) {
+                break;
+            }
+            auto end = min(begin + GC_WORKER_CHUNK_SIZE, victim.end_root);
+            collect_roots(worker, trial_roots.data() + begin, end - begin);
+        }
+    }
+}
+
+
+/**
+ * gc_collect を呼び出したスレッドを手伝うスレッドの処理
+ */
+void run_collector_helper(size_t worker_id, uint64_t generation) {
+    auto* pool = collector_pool;
+    while (true) {
+        unique_lock<mutex> pool_lock(pool->pool_mutex);
+        pool->start_condition.wait(pool_lock, [&]() { return pool->generation != generation; });
+        generation = pool->generation;
+        if (worker_id >= pool->number_of_workers) {
+            //今回の回収には参加しない
+            continue;
+        }
+        auto number_of_workers = pool->number_of_workers;
+        auto job = pool->job;
+        auto* trial_roots = pool->trial_roots;
+        pool_lock.unlock();
+
+        job(*(*collector_workers)[worker_id], *trial_roots, number_of_workers);
+
+        pool_lock.lock();
+        if (--pool->number_of_running == 0) {
+            pool->finish_condition.notify_one();
+        }
+    }
+}
+
+
+/**
+ * 足りない分のワーカーと手伝うスレッドを用意する
+ */
+void prepare_collector_workers(size_t number_of_workers) {
+    auto* pool = collector_pool;
+    while (collector_workers->size() < number_of_workers) {
+        auto* worker = new CollectorWorker();
+        worker->worker_id = collector_workers->size();
+        collector_workers->push_back(worker);
+
+        pool->pool_mutex.lock();
+        auto generation = pool->generation;
+        pool->pool_mutex.unlock();
+        thread(run_collector_helper, worker->worker_id, generation).detach();
+    }
+}
+
+
+/**
+ * number_of_workers 個のワーカーで job を実行し、全てのワーカーが終えるまで待つ
+ * gc_collect を呼び出したスレッドもワーカー 0 として参加する
+ */
+void run_on_collector_pool(CollectorJob job, vector<HeapObject*>& trial_roots, size_t number_of_workers) {
+    auto* pool = collector_pool;
+    prepare_collector_workers(number_of_workers);
+
+    //手伝うスレッドを起こす
+    pool->pool_mutex.lock();
+    pool->generation++;
+    pool->number_of_workers = number_of_workers;
+    pool->number_of_running = number_of_workers - 1;
+    pool->job = job;
+    pool->trial_roots = &trial_roots;
+    pool->pool_mutex.unlock();
+    pool->start_condition.notify_all();
+
+    job(*(*collector_workers)[0], trial_roots, number_of_workers);
+
+    unique_lock<mutex> pool_lock(pool->pool_mutex);
+    pool->finish_condition.wait(pool_lock, [&]() { return pool->number_of_running == 0; });
+    pool->job = nullptr;
+    pool->trial_roots = nullptr;
+}
+
+
+/**
+ * ルートオブジェクトを number_of_workers 個のワーカーに分けて並列に調べる
+ */
+void collect_roots_parallel(vector<HeapObject*>& trial_roots, size_t number_of_workers) {
+    //ルートオブジェクトを均等な範囲に分ける
+    prepare_collector_workers(number_of_workers);
+    for (size_t i = 0; i < number_of_workers; i++) {
+        auto* worker = (*collector_workers)[i];
+        worker->is_parallel = true;
+        //gc_collect を呼び出したスレッドのワーカーと同じ上限を使う
+        worker->max_trace_objects = collector_workers->front()->max_trace_objects;
+        worker->max_trace_bytes = collector_workers->front()->max_trace_bytes;
+        worker->next_root.store(trial_roots.size() * i / number_of_workers, memory_order_relaxed);
+        worker->end_root = trial_roots.size() * (i + 1) / number_of_workers;
+    }
+
+    run_on_collector_pool(run_collector_worker, trial_roots, number_of_workers);
+
+    for (size_t i = 0; i < number_of_workers; i++) {
+        (*collector_workers)[i]->is_parallel = false;
+    }
+}
+
+
+/**
+ * 作業用のスタックの古い方の半分を、他のワーカーが盗めるように公開する
+ */
+void share_work(CollectorWorker& worker) {
+    auto& mark_stack = worker.mark_stack;
+    auto half = (ptrdiff_t) (mark_stack.size() / 2);
+
+    worker.shared_stack_lock.lock();
+    worker.shared_stack.insert(worker.shared_stack.end(), mark_stack.begin(), mark_stack.begin() + half);
+    worker.shared_stack_size.store(worker.shared_stack.size(), memory_order_relaxed);
+    worker.shared_stack_lock.unlock();
+
+    mark_stack.erase(mark_stack.begin(), mark_stack.begin() + half);
+}
+
+
+/**
+ * 公開された作業の半分を自身の作業用のスタックへ移し、移せたかどうかを返す(自身が公開したものを含む)
+ */
+bool steal_work(CollectorWorker& worker, size_t number_of_workers) {
+    for (size_t i = 0; i < number_of_workers; i++) {
+        auto& victim = *(*collector_workers)[(worker.worker_id + i) % number_of_workers];
+        if (victim.shared_stack_size.load(memory_order_relaxed) == 0) {
+            continue;
+        }
+
+        victim.shared_stack_lock.lock();
+        auto size = victim.shared_stack.size();
+        if (size != 0) {
+            auto half = (size + 1) / 2;
+            worker.mark_stack.insert(worker.mark_stack.end(), victim.shared_stack.end() - (ptrdiff_t) half, victim.shared_stack.end());
+            victim.shared_stack.resize(size - half);
+            victim.shared_stack_size.store(size - half, memory_order_relaxed);
+            victim.shared_stack_lock.unlock();
+            return true;
+        }
+        victim.shared_stack_lock.unlock();
+    }
+    return false;
+}
+
+
+/**
+ * 盗める作業が公開されているかどうか
+ */
+bool has_shared_work(size_t number_of_workers) {
+    for (size_t i = 0; i < number_of_workers; i++) {
+        if ((*collector_workers)[i]->shared_stack_size.load(memory_order_relaxed) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * 全てのワーカーで共同して、作業用のスタックに積まれたオブジェクトから辿る
+ * visit は取り出したオブジェクトを処理し、辿るべきフィールドのオブジェクトを作業用のスタックへ積む
+ * 全てのワーカーの作業がなくなるまで戻らない
+ */
+template<typename Visit>
+void trace_shared(CollectorWorker& worker, size_t number_of_workers, Visit visit) {
+    auto& number_of_active = shared_collection.number_of_active;
+
+    while (true) {
+        while (!worker.mark_stack.empty()) {
+            auto* object = worker.mark_stack.back();
+            worker.mark_stack.pop_back();
+            visit(object);
+
+            if (worker.mark_stack.size() > GC_SHARED_STACK_THRESHOLD && worker.shared_stack_size.load(memory_order_relaxed) == 0) {
+                share_work(worker);
+            }
+        }
+
+        if (steal_work(worker, number_of_workers)) {
+            continue;
+        }
+
+        //自身の作業がなくなれば、全てのワーカーの作業がなくなるか盗める作業が公開されるまで待つ
+        //公開された作業は公開したワーカーが作業を終える前に必ず取り戻すため、作業を持つワーカーが居なければ残っていない
+        number_of_active.fetch_sub(1, memory_order_acq_rel);
+        while (true) {
+            if (number_of_active.load(memory_order_acquire) == 0) {
+                return;
+            }
+            if (!has_shared_work(number_of_workers)) {
+                this_thread::yield();
+                continue;
+            }
+            number_of_active.fetch_add(1, memory_order_acq_rel);
+            if (steal_work(worker, number_of_workers)) {
+                break;
+            }
+            number_of_active.fetch_sub(1, memory_order_acq_rel);
+            this_thread::yield();
+        }
+    }
+}
+
+
+/**
+ * 共同して辿る際の mark red phase
+ * 他のワーカーが着色したオブジェクトも共同して探索したものとして扱う
+ */
+void mark_red_shared(HeapObject* object, CollectorWorker& worker) {
+    //他のワーカーが先にロックを取得した場合は、着色されるか解除されるまで待つ
+    while (true) {
+        if (object->get_gc_color() != object_color::none) {
+            return;
+        }
+        if (object->try_lock()) {
+            break;
+        }
+        this_thread::yield();
+    }
+
+    //既に解放可能としてマークされている場合は辿らない
+    if (object->is_ready_to_release_with_gc()) {
+        object->unlock();
+        return;
+    }
+
+    //ロックを取得している間に、試行削除後のカウントをヘッダに格納できるかどうかを判定しておく
+    if (object->can_use_gc_scratch()) {
+        object->set_has_gc_scratch(true);
+    }
+    //赤に着色
+    object->set_gc_color(object_color::red);
+
+    worker.collect_objects.push_back(object);
+    push_field_objects(object, worker.mark_stack);
+}
+
+
+/**
+ * 他のワーカーが探索したものを含むオブジェクトの試行削除後のカウントを一つ減らす
+ * ヘッダに格納できないオブジェクトのカウントは探索したワーカーの count_map にあり、各フェーズの間は要素が追加されないため並行して探せる
+ */
+void decrement_trial_count_shared(HeapObject* object, size_t number_of_workers) {
+    if (object->has_gc_scratch()) {
+        object->decrement_gc_scratch();
+        return;
+    }
+    for (size_t i = 0; i < number_of_workers; i++) {
+        auto& count_map = (*collector_workers)[i]->count_map;
+        auto it = count_map.find(object);
+        if (it != count_map.end()) {
+            atomic_ref<size_t>(it->second).fetch_sub(1, memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+
+/**
+ * 全てのワーカーで共同してルートオブジェクトを調べるワーカーの処理
+ * 各ワーカーは自身が赤に着色したオブジェクトを担当し、それぞれのフェーズの間で全てのワーカーを待ち合わせる
+ *
+ *  1. Mark red phase : 作業を盗み合いながら全てのルートオブジェクトから辿り、ロックを取得して赤に着色する
+ *  2. Mark gray phase : 担当するオブジェクトのカウントを参照カウントで初期化した後、
+ *                       担当するオブジェクトから赤のオブジェクトへの参照の分だけ参照先のカウントを減らす
+ *                       逐次的に辿る場合と同様に、参照カウントが0のオブジェクトは黒に着色して参照先のカウントを減らさない
+ *  3. Mark black phase : カウントが0でないオブジェクトから作業を盗み合いながら辿り、赤のオブジェクトを黒に着色する
+ *  4. 赤のまま残ったオブジェクトを開放可能としてマークし、担当するオブジェクトのロックを解除する
+ *
+ * 辿った部分グラフの中でカウントが0でないオブジェクトから辿れるものが黒となり、それ以外が白となるため、結果は逐次的に辿る場合と一致する
+ */
+void run_shared_collector(CollectorWorker& worker, vector<HeapObject*>& trial_roots, size_t number_of_workers) {
+    auto& phase_barrier = *shared_collection.phase_barrier;
+
+    //Mark red phase
+    for (size_t i = worker.worker_id; i < trial_roots.size(); i += number_of_workers) {
+        worker.mark_stack.push_back(trial_roots[i]);
+    }
+    trace_shared(worker, number_of_workers, [&worker](HeapObject* object) {
+        mark_red_shared(object, worker);
+    });
+    phase_barrier.arrive_and_wait();
+
+    //Mark gray phase
+    for (auto* object : worker.collect_objects) {
+        auto ref_count = object->load_ref_count();
+        if (ref_count == 0) {
+            object->set_gc_color(object_color::black);
+        } else {
+            store_trial_count(object, ref_count, worker.count_map);
+        }
+    }
+    phase_barrier.arrive_and_wait();
+
+    for (auto* object : worker.collect_objects) {
+        if (object->get_gc_color() != object_color::red) {
+            continue;
+        }
+        auto** field_start_ptr = (HeapObject**) (object + 1);
+        size_t field_length = object->get_field_length();
+        for (size_t i = 0; i < field_length; i++) {
+            auto* field_object = field_start_ptr[i];
+            if (field_object != nullptr && field_object->get_gc_color() == object_color::red) {
+                decrement_trial_count_shared(field_object, number_of_workers);
+            }
+        }
+    }
+    phase_barrier.arrive_and_wait();
+
+    //Mark black phase
+    for (auto* object : worker.collect_objects) {
+        if (object->get_gc_color() == object_color::black) {
+            worker.mark_stack.push_back(object);
+        } else if (load_trial_count(object, worker.count_map) != 0 && object->compare_exchange_gc_color(object_color::red, object_color::black)) {
+            worker.mark_stack.push_back(object);
+        }
+    }
+    trace_shared(worker, number_of_workers, [&worker](HeapObject* object) {
+        auto** field_start_ptr = (HeapObject**) (object + 1);
+        size_t field_length = object->get_field_length();
+        for (size_t i = 0; i < field_length; i++) {
+            auto* field_object = field_start_ptr[i];
+            if (field_object != nullptr && field_object->compare_exchange_gc_color(object_color::red, object_color::black)) {
+                worker.mark_stack.push_back(field_object);
+            }
+        }
+    });
+    phase_barrier.arrive_and_wait();
+
+    //赤のまま残ったオブジェクトを開放可能なオブジェクトとしてマーク
+    for (auto* object : worker.collect_objects) {
+        if (object->get_gc_color() == object_color::red) {
+            object->mark_ready_to_release_with_gc();
+            worker.release_objects.push_back(object);
+        }
+    }
+
+    //作業用の情報を消去し、取得したロックを全て解除
+    clear_collect_objects(worker, 0);
+}
+
+
+/**
+ * 全てのワーカーで共同してルートオブジェクトを調べる
+ * 一つのルートオブジェクトから辿れる部分グラフが大きい場合も、複数のワーカーで分担して辿る
+ */
+void collect_roots_shared(vector<HeapObject*>& trial_roots, size_t number_of_workers) {
+    barrier<ResetActiveWorkers> phase_barrier((ptrdiff_t) number_of_workers);
+    shared_collection.phase_barrier = &phase_barrier;
+    shared_collection.number_of_workers = number_of_workers;
+    shared_collection.number_of_active.store(number_of_workers, memory_order_relaxed);
+
+    run_on_collector_pool(run_shared_collector, trial_roots, number_of_workers);
+
+    shared_collection.phase_barrier = nullptr;
+}
+
+
+/**
+ * 一度の回収で調べるルートオブジェクトと、その結果(collect_cycles の各段階で受け渡す)
+ */
+struct CollectionRoots {
+    //ルートオブジェクトの集合(少しずつ回収する場合は、今回調べたもののみ)
+    unordered_set<HeapObject*> roots;
+    //そのうち以前の回収を生き延びたもの
+    vector<HeapObject*> aged_roots;
+    //実行スレッド上で参照カウントが0になったルートオブジェクト
+    //循環参照の一部ではないため、デストラクタの呼び出しを実行スレッドに任せたものとして扱う
+    vector<HeapObject*> acyclic_roots;
+    //調べるルートオブジェクト
+    vector<HeapObject*> trial_roots;
+    //フィールドにオブジェクトを持たないため、調べずに残したルートオブジェクト
+    vector<HeapObject*> skipped_roots;
+    //生存しているという判定が有効なため、調べずに残したルートオブジェクト
+    vector<HeapObject*> cached_roots;
+    //ルートオブジェクトを取り出した後の世代(生存していると判定した後に変更されたかどうかを比べる)
+    uint64_t live_epoch = 0;
+    //解放されるオブジェクトの集合
+    unordered_set<HeapObject*> release_objects;
+};
+
+
+/**
+ * 今回の回収で調べるルートオブジェクトを取り出す
+ * 少しずつ回収する場合は、前回打ち切られて調べていないものが無くなった時のみ pending_roots へ新たに取り出す
+ * それ以外の場合は、取り出したものを調べるものと調べずに残すものに分ける
+ */
+void select_roots(CollectionRoots& collection, bool is_incremental, bool is_full) {
+    auto& roots = collection.roots;
+    auto& aged_roots = collection.aged_roots;
+
+    if (!is_incremental) {
+        //前回打ち切られて調べていないものと、前回解放できなかったものと、各スレッドのバッファに追記されたものをルートとする
+        aged_roots.assign(pending_roots.begin(), pending_roots.begin() + (ptrdiff_t) number_of_pending_aged);
+        roots.insert(pending_roots.begin(), pending_roots.end());
+        pending_roots.clear();
+        number_of_pending_aged = 0;
+
+        auto number_of_pending = aged_roots.size();
+        if (take_aged_roots(aged_roots, is_full)) {
+            is_old_roots_pending = true;
+        }
+        roots.insert(aged_roots.begin() + (ptrdiff_t) number_of_pending, aged_roots.end());
+        drain_suspect_buffers(roots);
+    } else if (pending_roots.empty()) {
+        //前回打ち切られて調べていないものが無くなれば、前回解放できなかったものと、各スレッドのバッファに追記されたものを取り出す
+        //以前の回収を生き延びたものを先頭に置く
+        if (take_aged_roots(pending_roots, false)) {
+            is_old_roots_pending = true;
+        }
+        number_of_pending_aged = pending_roots.size();
+
+        unordered_set<HeapObject*> new_roots;
+        drain_suspect_buffers(new_roots);
+        pending_roots.insert(pending_roots.end(), new_roots.begin(), new_roots.end());
+    }
+
+    //解放を遅らせていたオブジェクトがバッファから取り出されれば、ここで解放する
+    if (!deferred_release_objects.empty()) {
+        for (auto it = roots.begin(); it != roots.end();) {
+            if (deferred_release_objects.erase(*it) != 0) {
+                retire_heap_object(*it);
+                it = roots.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    //生存していると判定した後に変更されたかどうかを、ルートオブジェクトを取り出した後の世代と比べる
+    collection.live_epoch = load_live_epoch();
+
+    //少しずつ回収する場合は、調べる際に一つずつ分ける
+    if (is_incremental) {
+        return;
+    }
+
+    //フィールドにオブジェクトを持たないものと、生存しているという判定が有効なものは調べずに残す
+    for (auto& root : roots) {
+        if (root->is_ready_to_release_with_gc()) {
+            collection.acyclic_roots.push_back(root);
+        } else if (has_no_field_objects(root)) {
+            collection.skipped_roots.push_back(root);
+        } else if (!is_full && has_valid_live_verdict(root, collection.live_epoch)) {
+            collection.cached_roots.push_back(root);
+        } else {
+            collection.trial_roots.push_back(root);
+        }
+    }
+}
+
+
+/**
+ * まだ調べていないルートオブジェクトを一つずつ取り出して調べ、その度にロックを全て解除する
+ * 実行スレッドがロックを待つ時間は、一つのルートオブジェクトから辿れるオブジェクトの数までに抑えられる
+ * 進行を保証するため、上限に関わらず少なくとも一つは調べる
+ */
+void detect_cycles_incremental(CollectionRoots& collection, CollectorWorker& worker, size_t max_objects, chrono::steady_clock::time_point deadline) {
+    size_t number_of_traced = 0;
+    while (!pending_roots.empty()) {
+        auto* root = pending_roots.back();
+        pending_roots.pop_back();
+        if (pending_roots.size() < number_of_pending_aged) {
+            number_of_pending_aged = pending_roots.size();
+            collection.aged_roots.push_back(root);
+        }
+
+        //以前の呼び出しで他のルートオブジェクトから辿られて解放されたものは、ここで解放する
+        if (deferred_release_objects.erase(root) != 0) {
+            retire_heap_object(root);
+            continue;
+        }
+        collection.roots.insert(root);
+
+        if (root->is_ready_to_release_with_gc()) {
+            number_of_traced += collect_acyclic_root(root, collection.release_objects, worker.mark_stack);
+        } else if (has_no_field_objects(root)) {
+            collection.skipped_roots.push_back(root);
+        } else if (has_valid_live_verdict(root, collection.live_epoch)) {
+            collection.cached_roots.push_back(root);
+        } else {
+            number_of_traced += collect_roots(worker, &root, 1);
+        }
+
+        if (number_of_traced >= max_objects || chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+    }
+
+    //検証に失敗したルートオブジェクトは、調べたものとして次の回収へ回す
+    worker.contended_roots.clear();
+}
+
+
+/**
+ * ロックを取らずに、全てのルートオブジェクトをまとめて調べ、検証に失敗すれば半分ずつに分けて調べ直す
+ * 変更され続けるオブジェクトから辿れないルートオブジェクトを解放できるようにしつつ、調べ直す量は最初に辿った数までに抑える
+ * 調べ直せなかったものや一つでも失敗したルートオブジェクトは次の回収で再び調べる
+ */
+void detect_cycles_concurrent(CollectionRoots& collection, CollectorWorker& worker) {
+    auto& trial_roots = collection.trial_roots;
+
+    auto retry_budget = collect_roots(worker, trial_roots.data(), trial_roots.size());
+    vector<pair<size_t, size_t>> retry_ranges;
+    if (!worker.contended_roots.empty() && trial_roots.size() > 1) {
+        retry_ranges.emplace_back(0, trial_roots.size());
+    }
+    worker.contended_roots.clear();
+
+    while (!retry_ranges.empty() && retry_budget != 0) {
+        auto [begin, end] = retry_ranges.back();
+        retry_ranges.pop_back();
+
+        auto middle = begin + (end - begin) / 2;
+        for (auto [range_begin, range_end] : {pair(begin, middle), pair(middle, end)}) {
+            auto number_of_traced = collect_roots(worker, trial_roots.data() + range_begin, range_end - range_begin);
+            retry_budget -= min(number_of_traced, retry_budget);
+
+            if (!worker.contended_roots.empty() && range_end - range_begin > 1) {
+                retry_ranges.emplace_back(range_begin, range_end);
+            }
+            worker.contended_roots.clear();
+        }
+    }
+}
+
+
+/**
+ * number_of_workers 個のワーカーでルートオブジェクトを調べる
+ * 結果は各ワーカーの release_objects に残し、gather_worker_results で集める
+ */
+void detect_cycles_parallel(CollectionRoots& collection, CollectorWorker& worker, size_t number_of_workers) {
+    auto& trial_roots = collection.trial_roots;
+    //全てのワーカーで共同して調べるルートオブジェクト
+    vector<HeapObject*> shared_roots;
+
+    //上限を設定した場合は、少数のルートオブジェクトも上限を適用できるように分けて調べる
+    if (trial_roots.size() > GC_WORKER_CHUNK_SIZE || worker.max_trace_objects != SIZE_MAX || worker.max_trace_bytes != SIZE_MAX) {
+        //ルートオブジェクトを分けて並列に調べる
+        collect_roots_parallel(trial_roots, number_of_workers);
+
+        for (size_t i = 0; i < number_of_workers; i++) {
+            auto& contended_roots = (*collector_workers)[i]->contended_roots;
+            shared_roots.insert(shared_roots.end(), contended_roots.begin(), contended_roots.end());
+            contended_roots.clear();
+        }
+    } else {
+        shared_roots.swap(trial_roots);
+    }
+
+    //競合して調べられなかったものや、一つのワーカーで辿るには大きすぎたものは、全てのワーカーで共同して調べる
+    //共同して辿ったルートオブジェクトの判定は置き換えないため、以前の判定を全て無効にする
+    if (!shared_roots.empty()) {
+        collect_roots_shared(shared_roots, number_of_workers);
+        gc_live_epoch.fetch_add(1, memory_order_seq_cst);
+    }
+}
+
+
+/**
+ * 各ワーカーの結果を集める
+ * 白にマークしたオブジェクトを release_objects へ移し、生存していると判定したルートオブジェクトを記録して、
+ * 辿るオブジェクトが上限を超えたルートオブジェクトを返す
+ * ワーカーの数は今回の回収で使用したものとは限らないため、作成済みのワーカーを全て調べる
+ */
+vector<HeapObject*> gather_worker_results(CollectionRoots& collection) {
+    vector<HeapObject*> limited_roots;
+    for (auto* collector_worker : *collector_workers) {
+        auto& worker_release_objects = collector_worker->release_objects;
+        collection.release_objects.insert(worker_release_objects.begin(), worker_release_objects.end());
+        worker_release_objects.clear();
+
+        limited_roots.insert(limited_roots.end(), collector_worker->limited_roots.begin(), collector_worker->limited_roots.end());
+        collector_worker->limited_roots.clear();
+        collector_worker->over_limit_objects.clear();
+
+        for (auto& [root, verdict] : collector_worker->live_verdicts) {
+            if (verdict.ref_count == SIZE_MAX) {
+                live_verdicts.erase(root);
+            } else {
+                live_verdicts[root] = verdict;
+            }
+        }
+        collector_worker->live_verdicts.clear();
+    }
+    return limited_roots;
+}
+
+
+/**
+ * 解放可能と判定したオブジェクトを解放する
+ * まだいずれかのバッファに残っているものは、取り出されるまで解放を遅らせる
+ */
+void release_collected_objects(CollectionRoots& collection) {
+    auto& roots = collection.roots;
+
+    //開放可能なオブジェクトに対する処理
+    for (auto& object : collection.release_objects) {
+        //解放したオブジェクトの領域が再利用されても判定が残らないようにする
+        if (!live_verdicts.empty()) {
+            live_verdicts.erase(object);
+        }
+
+        //循環参照疑惑のあるルートの集合に含まれる場合は削除
+        //含まれないのにバッファに追記済みとしてマークされている場合は、取り出す前に追記が行われたものがバッファに残っている
+        //その場合はバッファから取り出されるまで解放を遅らせる(まだ調べていない pending_roots に残っている場合も同様)
+        if (roots.erase(object) == 0 && object->is_cyclic_type() && object->is_buffered(memory_order_relaxed)) {
+            deferred_release_objects.insert(object);
+        }
+
+        //開放する循環参照オブジェクトのフィールドオブジェクトのうち、
+        //白にマークされなかったオブジェクトの参照カウントを一つ減らす
+        auto** fields = (HeapObject**) (object + 1);
+        size_t field_length = object->get_field_length();
+        for (size_t i = 0; i < field_length; i++) {
+            auto* field_object = fields[i];
+            if (field_object != nullptr) {
+                if (!field_object->is_ready_to_release_with_gc()) {
+                    DynamicRC rc(field_object);
+                }
+            }
+        }
+    }
+
+    //開放可能なオブジェクトを開放
+    //ロックを取らずにフィールドを読んでいる他のスレッドがロードしている可能性があるため、解放を遅らせる
+    for (auto& object : collection.release_objects) {
+        if (deferred_release_objects.find(object) == deferred_release_objects.end()) {
+            retire_heap_object(object);
+        }
+    }
+}
 
-/**
- * Mark gray phase
- * Partial mark and sweep と同様
- */
-void mark_gray(HeapObject* current_object, unordered_map<HeapObject*, uint8_t>& color_map, unordered_map<HeapObject*, size_t>& count_map, bool is_first);
 
 /**
- * Mark white phase
- * Partial mark and sweep と同様
+ * 統計情報を記録し、解放できなかったルートオブジェクトを次の回収のために remaining_roots と old_roots へ分ける
+ * 古いルートオブジェクトを含めて調べ終えていれば、次に調べるまでの間隔と上限の倍率を決める
+ * release_collected_objects で解放したものを roots から取り除いた後に呼び出す
  */
-void mark_white(HeapObject* current_object, unordered_map<HeapObject*, uint8_t>& color_map, unordered_map<HeapObject*, size_t>& count_map);
+void update_root_tiers(CollectionRoots& collection, vector<HeapObject*>& limited_roots, CollectionResult& result) {
+    auto& roots = collection.roots;
+
+    //調べずに残したものを除き、解放できなかったルートオブジェクトは無駄に調べたものとして数える
+    //調べずに残したものも、他のルートオブジェクトから辿られて解放されている場合がある
+    size_t number_of_remaining_skipped = 0;
+    for (auto* root : collection.skipped_roots) {
+        number_of_remaining_skipped += roots.count(root);
+    }
+    for (auto* root : collection.cached_roots) {
+        number_of_remaining_skipped += roots.count(root);
+    }
+    number_of_traced_roots.fetch_add(result.number_of_roots - collection.skipped_roots.size() - collection.cached_roots.size(), memory_order_relaxed);
+    number_of_wasted_traces.fetch_add(roots.size() - number_of_remaining_skipped, memory_order_relaxed);
+    number_of_skipped_roots.fetch_add(collection.skipped_roots.size(), memory_order_relaxed);
+    number_of_cached_roots.fetch_add(collection.cached_roots.size(), memory_order_relaxed);
+    number_of_released_objects.fetch_add(result.number_of_released, memory_order_relaxed);
 
-/**
- * Mark black phase
- * Partial mark and sweep と同様 (ただしカウントの変更は行わない)
- */
-void mark_black(HeapObject* current_object, unordered_map<HeapObject*, uint8_t>& color_map, unordered_map<HeapObject*, size_t>& count_map);
+    //解放できなかったオブジェクトを再度回収を試みるために記憶しておく
+    //以前の回収を生き延びたものは古いルートオブジェクトとし、今回初めて調べたものは次の回収でも調べる
+    for (auto* root : collection.aged_roots) {
+        if (roots.erase(root) == 0) {
+            is_pending_aged_root_released = true;
+            continue;
+        }
+        root->set_gc_root(false);
+        root->set_suspect_next(old_roots);
+        old_roots = root;
+    }
+    //辿るオブジェクトが上限を超えたものは、今回初めて調べたものも古いルートオブジェクトとし、毎回は辿らない
+    //(以前の回収を生き延びたものと、他のルートオブジェクトから辿られて解放されたものは既に取り除かれている)
+    if (is_old_roots_pending && !limited_roots.empty()) {
+        is_old_roots_limit_hit = true;
+    }
+    for (auto* root : limited_roots) {
+        if (roots.erase(root) == 0) {
+            continue;
+        }
+        root->set_gc_root(false);
+        root->set_suspect_next(old_roots);
+        old_roots = root;
+    }
+    for (auto* root : roots) {
+        root->set_gc_root(false);
+        root->set_suspect_next(remaining_roots);
+        remaining_roots = root;
+    }
 
-/**
- * 回収可能かどうかをチェック
- */
-bool check_ready_to_collect(HeapObject* current_object, unordered_set<HeapObject*>& acyclic_objects);
+    result.is_finished = pending_roots.empty();
 
-SpinLock gc_lock{};
+    //古いルートオブジェクトを含めて調べ終えれば、次に調べるまでの間隔と上限の倍率を決める
+    //上限を超えたものが残れば、まだ解放できないとは限らないため間隔を広げず、次は倍の上限で辿る
+    if (result.is_finished && is_old_roots_pending) {
+        if (is_pending_aged_root_released) {
+            old_roots_interval = 1;
+        } else if (!is_old_roots_limit_hit) {
+            old_roots_interval = min(old_roots_interval * 2, (size_t) GC_OLD_ROOTS_MAX_INTERVAL);
+        }
+        if (is_old_roots_limit_hit) {
+            old_roots_trace_limit_scale = old_roots_trace_limit_scale <= SIZE_MAX / 2 ? old_roots_trace_limit_scale * 2 : SIZE_MAX;
+        } else {
+            old_roots_trace_limit_scale = 1;
+        }
+        collections_until_old_roots = old_roots_interval - 1;
+        is_old_roots_pending = false;
+        is_pending_aged_root_released = false;
+        is_old_roots_limit_hit = false;
+    }
+}
 
 
 /**
@@ -58,128 +1430,313 @@ SpinLock gc_lock{};
  * 
  * 基本的には単純に Partial Mark and Sweep に同時実行するための同期命令を加えたものである。
  * 参照の突然変異に対処するためにルートオブジェクトから辿ることのできる全てのオブジェクトに順次ロックをかけてから解放処理を行う。
+ * ルートオブジェクト毎に辿ると、多くのルートオブジェクトから辿れる部分グラフを何度もロックして辿ることになるため、
+ * Bacon と Rajan の同期的な手法と同様に、全てのルートオブジェクトをまとめて各フェーズを行う。
+ * number_of_workers に2以上を指定した場合は、ルートオブジェクトを一定数毎に区切って複数のワーカーで並列に調べる。
+ * ワーカー同士は mark red phase で取得するオブジェクトのロックにより排他され、他のワーカーが探索中のオブジェクトに
+ * 行き当たったルートオブジェクトや、辿るオブジェクトが多すぎたルートオブジェクトは、その後に全てのワーカーで共同して調べる(run_shared_collector を参照)。
  * また、非循環参照オブジェクトのデストラクタの呼び出しタイミングが決定的となるように、
- * 調査対象となるルートオブジェクトが循環参照の一部となるかどうかを調べ、場合分けを行いそれぞれ別々に解放する。
+ * 実行スレッド上で参照カウントが0になったルートオブジェクトはそれ以外と場合分けを行い、それぞれ別々に解放する。
  * 具体的には、循環参照オブジェクトである場合は実行スレッドから解放できないためそのままこの gc で解放しても問題ないと見なすが、
  * 非循環参照オブジェクトの場合はデストラクタの呼び出しを実行スレッドに任せそのスレッド上で解放可能であることをマークし、
  * gc のスレッドが動作するまで開放を遅らせる(開放の責任を押し付ける)。
+ * is_incremental が true の場合はルートオブジェクトを一つずつ調べ、調べたオブジェクトの数が max_objects に達するか
+ * deadline を過ぎた時点でルートオブジェクトの区切りで打ち切る。調べなかったルートオブジェクトは pending_roots に残し、
+ * それらを全て調べ終えるまではバッファから新たに取り出さない。
+ * 解放できなかったルートオブジェクトは、初めて調べたものは remaining_roots へ、二回目以降のものは old_roots へ移す。
+ * old_roots を調べても一つも解放できなければ調べる間隔を倍にし(GC_OLD_ROOTS_MAX_INTERVAL まで)、解放できれば毎回に戻す。
+ * 生存していると判定したルートオブジェクトは、その後に参照カウントが変わらず、辿った部分グラフのフィールドも変更されていなければ
+ * 辿らずに残す(LiveVerdict を参照)。これにより、変更されていない生存し続ける部分グラフを辿り直す量は変更の量に比例するまでに抑えられる。
+ * 一つのルートオブジェクトから新たに辿るオブジェクトが set_trace_limit の上限を超えた場合は、そのルートオブジェクトを打ち切って
+ * ロックを解除し、初めて調べたものであっても old_roots へ移す。old_roots を調べる回収では上限に old_roots_trace_limit_scale を掛け、
+ * 上限を超えたものが残る間は倍にしていくため、上限を超える大きさの循環参照もゴミになればいずれ回収される。
+ * is_full が true の場合は間隔に関わらず old_roots も調べ、判定も上限も使用しない。
+ *
+ * 一度の回収は、ルートオブジェクトの取り出し(select_roots)、回収の方法毎の判定(detect_cycles_incremental, detect_cycles_concurrent,
+ * detect_cycles_parallel, collect_roots)、各ワーカーの結果の集約(gather_worker_results)、解放(release_collected_objects)、
+ * 解放できなかったルートオブジェクトの振り分け(update_root_tiers)の順に行い、各段階は CollectionRoots を通して受け渡す。
  */
-void gc_collect() {
+CollectionResult collect_cycles(size_t number_of_workers, bool is_incremental, bool is_full, size_t max_objects, chrono::steady_clock::time_point deadline) {
     //単一のスレッドでしか実行できないようにロック
     gc_lock.lock();
 
-    //Swap suspected objects
-    unordered_set<HeapObject*> roots;
-    list_lock.lock();
-    swap(roots, suspected_object_set);
-    list_lock.unlock();
-
-    //解放されるオブジェクトの集合
-    unordered_set<HeapObject*> release_objects;
+    //今回調べるルートオブジェクトを取り出す
+    CollectionRoots collection;
+    select_roots(collection, is_incremental, is_full);
 
-    for (auto& root : roots) {
-        //オブジェクトの着色を一時的に記憶するためのマップ
-        unordered_map<HeapObject*, uint8_t> color_map;
-        //オブジェクトのカウントを一時的に記憶するためのマップ
-        unordered_map<HeapObject*, size_t> count_map;
-        //探索したオブジェクトのリスト
-        vector<HeapObject*> collect_objects;
-
-        //現在調べているルートオブジェクトが循環参照の輪の一部かどうか
-        bool is_cyclic_root = false;
-
-        //Mark red phase
-        //ルートオブジェクトからロックを掛けつつ辿りながら、赤に着色する
-        mark_red(root, root, color_map, collect_objects, is_cyclic_root);
-
-        //現在調べているルートオブジェクトが循環参照の輪の一部かどうか
-        if (is_cyclic_root) {
-            //循環参照である場合
-            
-            //Mark gray phase
-            //Partial mark and sweep と同様
-            mark_gray(root, color_map, count_map, true);
-
-            //Mark white or black phase
-            //Partial mark and sweep と同様
-            mark_white(root, color_map, count_map);
-            
-            //白にマークしたオブジェクトを開放可能なオブジェクトとしてマーク
-            for (auto& object : collect_objects) {
-                if (color_map[object] == object_color::white) {
-                    object->ready_to_release_with_gc.store(true, memory_order_release);
-                    release_objects.insert(object);
-                }
-            }
+    //gc_collect を呼び出したスレッドのワーカー
+    if (collector_workers->empty()) {
+        collector_workers->push_back(new CollectorWorker());
+    }
+    auto& worker = *collector_workers->front();
 
-            //取得したロックを全て解除
-            for (auto& object : collect_objects) {
-                object->unlock();
-            }
-        } else {
-            //非循環参照オブジェクトである場合
+    //ロックを取らずに辿る場合、実行スレッドが解放したオブジェクトのフィールドを読むことがあるため、辿り終えるまで解放を遅らせる
+    worker.is_concurrent = concurrent_detection;
+    if (worker.is_concurrent) {
+        enter_epoch();
+    }
 
-            //取得したロックを全て解除
-            for (auto& object : collect_objects) {
-                object->unlock();
-            }
+    //全て回収する場合は上限を適用せず、古いルートオブジェクトを調べる場合は倍率を掛けた上限を適用する
+    auto trace_limit_scale = is_old_roots_pending ? old_roots_trace_limit_scale : 1;
+    worker.max_trace_objects = is_full ? SIZE_MAX : scale_trace_limit(trace_limit_objects, trace_limit_scale);
+    worker.max_trace_bytes = is_full ? SIZE_MAX : scale_trace_limit(trace_limit_bytes, trace_limit_scale);
+
+    //回収の方法毎に循環参照を判定する
+    if (is_incremental) {
+        detect_cycles_incremental(collection, worker, max_objects, deadline);
+    } else if (worker.is_concurrent) {
+        detect_cycles_concurrent(collection, worker);
+    } else if (number_of_workers > 1) {
+        detect_cycles_parallel(collection, worker, number_of_workers);
+    } else {
+        //全てのルートオブジェクトをまとめて調べる
+        collect_roots(worker, collection.trial_roots.data(), collection.trial_roots.size());
+    }
 
-            //実行スレッド上で開放可能としてマークされているかどうかをチェック
-            unordered_set<HeapObject*> acyclic_objects;
-            bool ready_to_release = check_ready_to_collect(root, acyclic_objects);
-            
-            //マークされている場合は開放可能として記憶
-            if (ready_to_release) {
-                for (auto& object : acyclic_objects) {
-                    release_objects.insert(object);
-                }
-            }
+    if (!is_incremental) {
+        for (auto& root : collection.acyclic_roots) {
+            collect_acyclic_root(root, collection.release_objects, worker.mark_stack);
         }
     }
 
-    //開放可能なオブジェクトに対する処理
-    for (auto& object : release_objects) {
-        //循環参照疑惑のあるルートの集合に含まれる場合は削除
-        roots.erase(object);
-        if (object->is_cyclic_type && object->buffered.load(std::memory_order_relaxed)) {
-            list_lock.lock();
-            suspected_object_set.erase(object);
-            list_lock.unlock();
+    if (worker.is_concurrent) {
+        exit_epoch();
+    }
+
+    //各ワーカーの結果を集めてから解放し、解放できなかったルートオブジェクトを次の回収へ回す
+    auto limited_roots = gather_worker_results(collection);
+
+    CollectionResult result;
+    result.number_of_roots = collection.roots.size();
+    result.number_of_released = collection.release_objects.size();
+
+    release_collected_objects(collection);
+    update_root_tiers(collection, limited_roots, result);
+
+    //gc 用のロックを解除
+    gc_lock.unlock();
+
+    return result;
+}
+
+
+void gc_collect(size_t number_of_workers) {
+    collect_cycles(number_of_workers, false, false, SIZE_MAX, chrono::steady_clock::time_point::max());
+}
+
+
+void gc_collect_all(size_t number_of_workers) {
+    collect_cycles(number_of_workers, false, true, SIZE_MAX, chrono::steady_clock::time_point::max());
+}
+
+
+bool gc_collect_step(size_t max_objects) {
+    return collect_cycles(1, true, false, max_objects, chrono::steady_clock::time_point::max()).is_finished;
+}
+
+
+bool gc_collect_for(chrono::nanoseconds budget) {
+    return collect_cycles(1, true, false, SIZE_MAX, chrono::steady_clock::now() + budget).is_finished;
+}
+
+
+void set_concurrent_detection(bool is_enabled) {
+    gc_lock.lock();
+    concurrent_detection = is_enabled;
+    gc_lock.unlock();
+}
+
+
+void set_cycle_detection_engine(cycle_detection_engine engine) {
+    gc_lock.lock();
+    detection_engine = engine;
+    gc_lock.unlock();
+}
+
+
+void set_trace_limit(size_t max_objects, size_t max_bytes) {
+    gc_lock.lock();
+    trace_limit_objects = max_objects;
+    trace_limit_bytes = max_bytes;
+    gc_lock.unlock();
+}
+
+
+void set_suspect_trigger(suspect_trigger trigger) {
+    current_suspect_trigger.store(trigger, memory_order_relaxed);
+}
+
+
+CycleCollectorStats get_cycle_collector_stats() {
+    CycleCollectorStats stats;
+
+    //終了したスレッドのバッファも一覧に残っている
+    suspect_buffers_lock.lock();
+    for (auto* buffer : suspect_buffers) {
+        stats.number_of_suspected += buffer->number_of_suspected.load(memory_order_relaxed);
+    }
+    suspect_buffers_lock.unlock();
+
+    stats.number_of_traced_roots = number_of_traced_roots.load(memory_order_relaxed);
+    stats.number_of_wasted_traces = number_of_wasted_traces.load(memory_order_relaxed);
+    stats.number_of_skipped_roots = number_of_skipped_roots.load(memory_order_relaxed);
+    stats.number_of_cached_roots = number_of_cached_roots.load(memory_order_relaxed);
+    stats.number_of_released = number_of_released_objects.load(memory_order_relaxed);
+    stats.number_of_trace_limit_hits = number_of_trace_limit_hits.load(memory_order_relaxed);
+    stats.number_of_abandoned_objects = number_of_abandoned_objects.load(memory_order_relaxed);
+    return stats;
+}
+
+
+/**
+ * コレクタサービスの状態
+ * プロセスの終了処理の中で実行スレッドから起こされる場合があるため、破棄しない
+ */
+struct CollectorService {
+    mutex service_mutex;
+    condition_variable wake_condition;
+    //間隔を待たずに回収するよう要求されたかどうか
+    bool is_wake_requested = false;
+    //停止を要求されたかどうか(少しずつ回収している間はロックを取らずに確認する)
+    atomic_bool is_stop_requested{false};
+    //起動しているかどうか(start_collector_service / stop_collector_service のみが操作する)
+    bool is_running = false;
+    thread collector_thread;
+    CollectorServiceOptions options;
+};
+
+atomic<size_t> collector_service_wake_threshold{0};
+auto* collector_service = new CollectorService();
+
+//起動と停止を直列化する
+mutex collector_service_control_mutex;
+
+
+void wake_collector_service() {
+    auto* service = collector_service;
+    lock_guard<mutex> service_lock(service->service_mutex);
+    service->is_wake_requested = true;
+    service->wake_condition.notify_one();
+}
+
+
+/**
+ * コレクタのスレッドを指定された CPU に固定し、スケジューリングポリシーを設定する
+ */
+void apply_collector_thread_options(const CollectorServiceOptions& options) {
+#ifdef __linux__
+    if (options.cpu >= 0) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(options.cpu, &cpu_set);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    }
+    if (options.use_idle_scheduling) {
+        sched_param param{};
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    }
+#else
+    (void) options;
+#endif
+}
+
+
+/**
+ * 回収の結果から次の回収までの間隔を決める
+ * ルートオブジェクトが前回より増えているか、調べたものの半分以上を解放できた場合は間隔を半分にし、
+ * ルートオブジェクトが無いか、殆ど解放できなかった場合は間隔を倍にする
+ */
+chrono::microseconds next_collector_interval(const CollectorServiceOptions& options, chrono::microseconds interval,
+                                             const CollectionResult& result, size_t previous_number_of_roots) {
+    if (result.number_of_roots == 0 || result.number_of_released * 8 < result.number_of_roots) {
+        interval *= 2;
+    } else if (result.number_of_roots > previous_number_of_roots || result.number_of_released * 2 >= result.number_of_roots) {
+        interval /= 2;
+    }
+    return clamp(interval, options.min_interval, options.max_interval);
+}
+
+
+/**
+ * コレクタサービスのスレッドの処理
+ */
+void run_collector_service() {
+    auto* service = collector_service;
+    auto options = service->options;
+    apply_collector_thread_options(options);
+
+    auto interval = options.min_interval;
+    size_t previous_number_of_roots = 0;
+
+    unique_lock<mutex> service_lock(service->service_mutex);
+    while (true) {
+        //要求されるか間隔が経過するまで待機する
+        service->wake_condition.wait_for(service_lock, interval, [&]() {
+            return service->is_wake_requested || service->is_stop_requested;
+        });
+        if (service->is_stop_requested) {
+            break;
         }
+        service->is_wake_requested = false;
+        service_lock.unlock();
 
-        //開放する循環参照オブジェクトのフィールドオブジェクトのうち、
-        //白にマークされなかったオブジェクトの参照カウントを一つ減らす
-        auto** fields = (HeapObject**) (object + 1);
-        size_t field_length = object->field_length;
-        for (size_t i = 0; i < field_length; i++) {
-            auto* field_object = fields[i];
-            if (field_object != nullptr) {
-                if (!field_object->ready_to_release_with_gc.load(memory_order_acquire)) {
-                    DynamicRC rc(field_object);
-                }
-            }
+        CollectionResult result;
+        if (options.max_objects_per_step == 0) {
+            result = collect_cycles(options.number_of_workers, false, false, SIZE_MAX, chrono::steady_clock::time_point::max());
+        } else {
+            //調べたルートオブジェクトを合計し、停止を要求されれば途中でも止める
+            CollectionResult step_result;
+            do {
+                step_result = collect_cycles(1, true, false, options.max_objects_per_step, chrono::steady_clock::time_point::max());
+                result.number_of_roots += step_result.number_of_roots;
+                result.number_of_released += step_result.number_of_released;
+            } while (!step_result.is_finished && !service->is_stop_requested.load(memory_order_relaxed));
         }
+
+        interval = next_collector_interval(options, interval, result, previous_number_of_roots);
+        previous_number_of_roots = result.number_of_roots;
+
+        service_lock.lock();
     }
+}
 
-    //開放可能なオブジェクトを開放
-    for (auto& object : release_objects) {
-        free(object);
 
-        #if RC_VALIDATION
-            //生存しているオブジェクト数を一つ減らす
-            global_object_count.fetch_sub(1, memory_order_relaxed);
-        #endif
+void start_collector_service(const CollectorServiceOptions& options) {
+    lock_guard<mutex> control_lock(collector_service_control_mutex);
+    auto* service = collector_service;
+    if (service->is_running) {
+        return;
     }
 
-    //解放できなかったオブジェクトを再度回収を試みるために記憶しておく
-    for (auto& root : roots) {
-        list_lock.lock();
-        suspected_object_set.insert(root);
-        list_lock.unlock();
+    service->options = options;
+    service->options.min_interval = max(options.min_interval, chrono::microseconds(1));
+    service->options.max_interval = max(options.max_interval, service->options.min_interval);
+    service->is_wake_requested = false;
+    service->is_stop_requested = false;
+    service->is_running = true;
+    service->collector_thread = thread(run_collector_service);
+
+    collector_service_wake_threshold.store(options.wake_threshold, memory_order_relaxed);
+}
+
+
+void stop_collector_service() {
+    lock_guard<mutex> control_lock(collector_service_control_mutex);
+    auto* service = collector_service;
+    if (!service->is_running) {
+        return;
     }
 
-    //gc 用のロックを解除
-    gc_lock.unlock();
+    collector_service_wake_threshold.store(0, memory_order_relaxed);
+
+    {
+        lock_guard<mutex> service_lock(service->service_mutex);
+        service->is_stop_requested = true;
+        service->wake_condition.notify_one();
+    }
+    service->collector_thread.join();
+    service->is_running = false;
 }
 
 
@@ -187,81 +1744,182 @@ void gc_collect() {
 
 /**
  * ルートオブジェクトとそれに連なる全てのオブジェクトを、ロックを取得しながら赤に着色する
+ * 並列に回収している場合、他のワーカーが探索中のオブジェクトに行き当たるか、辿るオブジェクトが多すぎれば contended を返す
+ * 新たに辿ったオブジェクトの数かバイト数がワーカーの上限を超えれば、その時点で打ち切って over_trace_limit を返す
  */
-void mark_red(HeapObject* root, HeapObject* current_object, unordered_map<HeapObject*, uint8_t>& color_map, vector<HeapObject*>& collect_objects, bool& is_cyclic_root) {
-    //オブジェクトが既に着色されているかどうか
-    if (color_map.find(current_object) != color_map.end()) {
-        //されていれば処理を中断
-        return;
-    }
-
-    //赤に着色
-    color_map[current_object] = object_color::red;
-    //ロックを取得
-    current_object->lock();
+mark_red_result mark_red(HeapObject* root, CollectorWorker& worker) {
+    auto& mark_stack = worker.mark_stack;
+    auto begin = worker.collect_objects.size();
+    //新たに辿ったオブジェクトの大きさの合計(ヘッダとフィールド)
+    size_t traced_bytes = 0;
+    //上限を設定した場合は、共同して辿る代わりに上限まで一つのワーカーで辿る
+    bool is_trace_limited = worker.max_trace_objects != SIZE_MAX || worker.max_trace_bytes != SIZE_MAX;
+    mark_stack.push_back(root);
+
+    while (!mark_stack.empty()) {
+        auto* current_object = mark_stack.back();
+        mark_stack.pop_back();
+
+        //オブジェクトが既に着色されているかどうか
+        if (current_object->get_gc_color() != object_color::none) {
+            //自身が着色したものであれば辿らない
+            if (!worker.is_parallel || is_marked_by(current_object, worker)) {
+                continue;
+            }
+            //他のワーカーが探索中
+            mark_stack.clear();
+            return mark_red_result::contended;
+        }
 
-    collect_objects.push_back(current_object);
+        //今回の回収で上限を超えたルートオブジェクトから辿ったものであれば、同じ構造に行き当たったものとして打ち切る
+        //(打ち切っても後回しにするのみであるため、実際には上限を超えないものを打ち切っても安全である)
+        if (!worker.over_limit_objects.empty() && worker.over_limit_objects.find(current_object) != worker.over_limit_objects.end()) {
+            mark_stack.clear();
+            return mark_red_result::over_trace_limit;
+        }
 
-    //オブジェクトの開始ポインタ
-    auto** field_start_ptr = (HeapObject**) (current_object + 1);
-    size_t field_length = current_object->field_length;
+        if (worker.is_concurrent) {
+            //ロックを取らずに辿る場合は、解放可能としてマークされていなければ赤に着色してフィールドを辿る
+            //試行削除後のカウントは全て count_map に格納する
+            if (current_object->is_ready_to_release_with_gc()) {
+                continue;
+            }
+            current_object->begin_gc_trace(object_color::red);
+        } else {
+            //ロックを取得
+            //並列に回収している場合は、ワーカー同士がロックを待ち合って止まらないように待たずに諦める
+            if (!worker.is_parallel) {
+                current_object->lock();
+            } else if (!current_object->try_lock()) {
+                mark_stack.clear();
+                return mark_red_result::contended;
+            }
 
-    for (size_t i = 0; i < field_length; i++) {
-        auto* field_object = field_start_ptr[i];
+            //既に解放可能としてマークされている場合は辿らない
+            //他のワーカーが白に着色したか、実行スレッド上で参照カウントが0になったものであり、このオブジェクトからの参照は差し引かれない
+            if (current_object->is_ready_to_release_with_gc()) {
+                current_object->unlock();
+                continue;
+            }
 
-        if (field_object != nullptr) {
-            //フィールドのオブジェクトがルートオブジェクトと一致するかどうか
-            if (field_object == root) {
-                //一致していれば、ルートオブジェクトは循環参照の一部であることがわかる
-                //その情報を is_cyclic_root へ反映する
-                is_cyclic_root = true;
+            //ロックを取得している間に、試行削除後のカウントをヘッダに格納できるかどうかを判定しておく
+            if (current_object->can_use_gc_scratch()) {
+                current_object->set_has_gc_scratch(true);
+                if (worker.is_parallel) {
+                    current_object->store_gc_scratch(worker.worker_id + 1);
+                }
+            } else if (worker.is_parallel) {
+                worker.count_map[current_object] = 0;
             }
+            //赤に着色する
+            current_object->set_gc_color(object_color::red);
+        }
+        //辿ったことを記録する(以降のフィールドの変更は実行スレッドが live_verdicts を無効にする)
+        current_object->mark_gc_live();
+
+        worker.collect_objects.push_back(current_object);
+
+        //辿るオブジェクトが上限を超えれば、ロックを保持し続けないように打ち切る
+        auto number_of_traced = worker.collect_objects.size() - begin;
+        traced_bytes += sizeof(HeapObject) + sizeof(HeapObject*) * current_object->get_field_length();
+        if (number_of_traced > worker.max_trace_objects || traced_bytes > worker.max_trace_bytes) {
+            mark_stack.clear();
+            return mark_red_result::over_trace_limit;
+        }
+
+        //並列に回収している場合、辿るオブジェクトが多すぎれば全てのワーカーで共同して辿るために諦める
+        if (worker.is_parallel && !is_trace_limited && number_of_traced > GC_WORKER_TRACE_LIMIT) {
+            mark_stack.clear();
+            return mark_red_result::contended;
+        }
+
+        //各フィールドのオブジェクトを辿る
+        push_field_objects(current_object, mark_stack);
+    }
 
-            mark_red(root, field_object, color_map, collect_objects, is_cyclic_root);
+    return mark_red_result::marked;
+}
+
+
+/**
+ * mark gray phase で試行削除を始める参照カウントを読む
+ * ロックを取らずに辿る場合は、検証のために読んだ値を記録する。ただし、biased モードのオブジェクトと
+ * 共有されたことがまだ記録されていない(biased モードへ切り替わりうる)オブジェクトは所有スレッドが同期せずに増減させるため、
+ * 外部からの参照があるものとして一つ多く数え、検証はしない。参照カウントが0のものは実行スレッドが解放している最中であり、同様に扱う
+ * ルートオブジェクトとして記録されているものは、今回取り出したものでなくとも読んだ値を LiveVerdict として記録する
+ * (ある判定が古いまま残ると、他のルートオブジェクトの判定と合わせて循環参照を見逃す場合がある)
+ */
+size_t load_gray_ref_count(HeapObject* object, CollectorWorker& worker) {
+    if (!worker.is_concurrent) {
+        auto ref_count = object->load_ref_count();
+        if (object->is_buffered(memory_order_relaxed)) {
+            worker.buffered_ref_counts.emplace_back(object, ref_count == 0 ? SIZE_MAX : ref_count);
+        }
+        return ref_count;
+    }
+
+    auto count_word = object->load_count_word();
+    auto ref_count = object->load_ref_count();
+    if (!(count_word & RC_MUTEX_BIT) || (count_word & RC_BIASED_BIT) || ref_count == 0) {
+        worker.observed_counts[object] = SIZE_MAX;
+        if (object->is_buffered(memory_order_relaxed)) {
+            worker.buffered_ref_counts.emplace_back(object, SIZE_MAX);
         }
+        return ref_count + 1;
     }
+    worker.observed_counts[object] = ref_count;
+    if (object->is_buffered(memory_order_relaxed)) {
+        worker.buffered_ref_counts.emplace_back(object, ref_count);
+    }
+    return ref_count;
 }
 
 
 /**
  * Mark gray phase
  * Partial mark and sweep と同様
+ * 未着色のフィールドのオブジェクトは mark red phase で辿らなかったものであるため、以降のフェーズでも辿らない
  */
-void mark_gray(HeapObject* current_object, unordered_map<HeapObject*, uint8_t>& color_map, unordered_map<HeapObject*, size_t>& count_map, bool is_first) {
-    //オブジェクトが灰色に着色されているかどうか
-    if (color_map[current_object] == object_color::gray) {
-        //されていればカウントを一つ減らす
-        count_map[current_object]--;
-        //処理を中断
+void mark_gray(HeapObject* root, CollectorWorker& worker) {
+    auto& mark_stack = worker.mark_stack;
+    auto& count_map = worker.count_map;
+
+    //開始点の参照カウントを取得
+    auto root_ref_count = load_gray_ref_count(root, worker);
+    //開始点の参照カウントが0であれば、実行スレッドが解放処理を行っている最中であり循環参照の一部ではない
+    //解放を実行スレッドに任せるため、黒に着色して探索しない
+    if (root_ref_count == 0) {
+        root->set_gc_color(object_color::black);
         return;
-    } else {
-        //されていなければ
-        //灰色に着色
-        color_map[current_object] = object_color::gray;
-
-        //現在の参照カウントを取得
-        auto ref_count = ((atomic_size_t*) &current_object->reference_count)->load(memory_order_acquire);
-        //マークの開始点かどうか
-        if (is_first) {
-            //開始点であれば、単に現在の参照カウントを登録
-            count_map[current_object] = ref_count;
-        } else {
-            //そうでなければ、参照カウントを一つ減らして登録
-            count_map[current_object] = ref_count - 1;
-        }
     }
 
-    //オブジェクトの開始ポインタ
-    auto** field_start_ptr = (HeapObject**) (current_object + 1);
-    size_t field_length = current_object->field_length;
+    //開始点は灰色に着色し、単に現在の参照カウントを登録
+    root->set_gc_color(object_color::gray);
+    store_trial_count(root, root_ref_count, count_map);
+    push_field_objects(root, mark_stack);
 
-    //各フィールドのオブジェクトに対して mark gray を再帰的に呼び出す
-    for (size_t i = 0; i < field_length; i++) {
-        auto* field_object = field_start_ptr[i];
+    //各フィールドのオブジェクトを辿る
+    while (!mark_stack.empty()) {
+        auto* current_object = mark_stack.back();
+        mark_stack.pop_back();
 
-        if (field_object != nullptr) {
-            mark_gray(field_object, color_map, count_map, false);
+        auto color = current_object->get_gc_color();
+        if (color == object_color::none) {
+            continue;
+        }
+
+        //オブジェクトが灰色に着色されているかどうか
+        if (color == object_color::gray) {
+            //されていればカウントを一つ減らす
+            store_trial_count(current_object, load_trial_count(current_object, count_map) - 1, count_map);
+            continue;
         }
+
+        //されていなければ灰色に着色し、参照カウントを一つ減らして登録
+        current_object->set_gc_color(object_color::gray);
+        store_trial_count(current_object, load_gray_ref_count(current_object, worker) - 1, count_map);
+
+        push_field_objects(current_object, mark_stack);
     }
 }
 
@@ -270,34 +1928,31 @@ void mark_gray(HeapObject* current_object, unordered_map<HeapObject*, uint8_t>&
  * Mark white phase
  * Partial mark and sweep と同様
  */
-void mark_white(HeapObject* current_object, unordered_map<HeapObject*, uint8_t>& color_map, unordered_map<HeapObject*, size_t>& count_map) {
-    //オブジェクトが灰色以外に着色されている場合は何もしない
-    if (color_map[current_object] != object_color::gray) {
-        return;
-    }
+void mark_white(HeapObject* root, CollectorWorker& worker) {
+    auto& mark_stack = worker.mark_stack;
+    mark_stack.push_back(root);
 
-    //参照カウントを取得
-    auto ref_count = count_map[current_object];
-    if (ref_count != 0) {
-        //参照カウントが0でない場合は、処理を中断して mark black phase へ移行する
-        mark_black(current_object, color_map, count_map);
-        return;
-    }
+    while (!mark_stack.empty()) {
+        auto* current_object = mark_stack.back();
+        mark_stack.pop_back();
 
-    //白に着色
-    color_map[current_object] = object_color::white;
+        //オブジェクトが灰色以外に着色されている場合は何もしない
+        if (current_object->get_gc_color() != object_color::gray) {
+            continue;
+        }
 
-    //オブジェクトの開始ポインタ
-    auto** field_start_ptr = (HeapObject**) (current_object + 1);
-    size_t field_length = current_object->field_length;
+        //参照カウントを取得
+        auto ref_count = load_trial_count(current_object, worker.count_map);
+        if (ref_count != 0) {
+            //参照カウントが0でない場合は、このオブジェクトから mark black phase へ移行する
+            mark_black(current_object, worker);
+            continue;
+        }
 
-    //各フィールドのオブジェクトに対して mark white を再帰的に呼び出す
-    for (size_t i = 0; i < field_length; i++) {
-        auto* field_object = field_start_ptr[i];
+        //白に着色
+        current_object->set_gc_color(object_color::white);
 
-        if (field_object != nullptr) {
-            mark_white(field_object, color_map, count_map);
-        }
+        push_field_objects(current_object, mark_stack);
     }
 }
 
@@ -306,26 +1961,179 @@ void mark_white(HeapObject* current_object, unordered_map<HeapObject*, uint8_t>&
  * Mark black phase
  * Partial mark and sweep と同様 (ただしカウントの変更は行わない)
  */
-void mark_black(HeapObject* current_object, unordered_map<HeapObject*, uint8_t>& color_map, unordered_map<HeapObject*, size_t>& count_map) {
-    //オブジェクトが黒に着色されている場合は何もしない
-    if (color_map[current_object] == object_color::black) {
-        return;
+void mark_black(HeapObject* root, CollectorWorker& worker) {
+    auto& mark_stack = worker.mark_stack;
+    //mark white phase の途中から呼び出されるため、それまでに積まれた分には触れない
+    auto base = mark_stack.size();
+    mark_stack.push_back(root);
+
+    while (mark_stack.size() > base) {
+        auto* current_object = mark_stack.back();
+        mark_stack.pop_back();
+
+        //オブジェクトが未着色か黒に着色されている場合は何もしない
+        auto color = current_object->get_gc_color();
+        if (color == object_color::none || color == object_color::black) {
+            continue;
+        }
+
+        //黒に着色
+        current_object->set_gc_color(object_color::black);
+
+        push_field_objects(current_object, mark_stack);
     }
+}
 
-    //黒に着色
-    color_map[current_object] = object_color::black;
 
-    //オブジェクトの開始ポインタ
-    auto** field_start_ptr = (HeapObject**) (current_object + 1);
-    size_t field_length = current_object->field_length;
+/**
+ * 強連結成分に分解する際に、赤のオブジェクトを訪れて灰色に着色し、Tarjan のスタックへ積む
+ * 訪れた順の番号を作業用のカウントの代わりに格納し、参照カウントもこの時点で読む
+ */
+inline uint32_t visit_scc_node(HeapObject* object, CollectorWorker& worker) {
+    auto index = (uint32_t) worker.scc_nodes.size();
+    auto ref_count = load_gray_ref_count(object, worker);
+    worker.scc_nodes.push_back(SccNode{index, UINT32_MAX, 0, (uint32_t) min(ref_count, (size_t) UINT32_MAX)});
+    worker.scc_objects.push_back(object);
+    object->set_gc_color(object_color::gray);
+    store_trial_count(object, index, worker.count_map);
+    worker.scc_stack.push_back(index);
+    worker.scc_frames.emplace_back(index, 0);
+    return index;
+}
 
-    //各フィールドのオブジェクトに対して mark black を再帰的に呼び出す
-    for (size_t i = 0; i < field_length; i++) {
-        auto* field_object = field_start_ptr[i];
 
-        if (field_object != nullptr) {
-            mark_black(field_object, color_map, count_map);
+/**
+ * mark red phase で辿った部分グラフを強連結成分に分解し、解放できる成分のオブジェクトを白に、それ以外を黒に着色する
+ *
+ * Tarjan の方法を明示的なスタックで行い、見つけた順に成分へ番号を付ける。成分はそこから辿れる全ての成分よりも後に見つかるため、
+ * 参照は常に番号の大きい成分から小さい成分へ向かう。探索しながら各オブジェクトへの部分グラフの内側からの参照と、
+ * 異なる成分の間の参照を記録し、参照カウントと一致しないオブジェクト(外からの参照を持つもの)を含む成分を生存しているものとする。
+ * その後に番号の大きい順に、生存している成分から参照される成分を生存しているものとすれば、残りの成分は丸ごと解放できる。
+ * 部分グラフは探索の一度しか辿らず、伝搬は記録した成分の間の参照のみで行う。
+ * 試行削除と同様に、未着色のフィールドのオブジェクトは mark red phase で辿らなかったものであるため数えない
+ */
+void mark_strongly_connected_components(CollectorWorker& worker) {
+    auto& objects = worker.scc_objects;
+    auto& nodes = worker.scc_nodes;
+    auto& stack = worker.scc_stack;
+    auto& frames = worker.scc_frames;
+    auto& edges = worker.scc_edges;
+    objects.clear();
+    nodes.clear();
+    edges.clear();
+
+    uint32_t number_of_components = 0;
+    for (auto* start : worker.collect_objects) {
+        if (start->get_gc_color() != object_color::red) {
+            continue;
+        }
+        visit_scc_node(start, worker);
+
+        while (!frames.empty()) {
+            auto index = frames.back().first;
+            auto* object = objects[index];
+            auto** field_start_ptr = (HeapObject**) (object + 1);
+            auto field_length = (uint32_t) object->get_field_length();
+
+            //次に辿る未訪問のオブジェクトを探す
+            auto field_index = frames.back().second;
+            auto next = UINT32_MAX;
+            while (field_index < field_length) {
+                auto* field_object = ((atomic<HeapObject*>*) &field_start_ptr[field_index])->load(memory_order_seq_cst);
+                field_index++;
+                if (field_object == nullptr) {
+                    continue;
+                }
+
+                auto color = field_object->get_gc_color();
+                if (color == object_color::red) {
+                    frames.back().second = field_index;
+                    next = visit_scc_node(field_object, worker);
+                    nodes[next].internal_count++;
+                    break;
+                }
+                if (color != object_color::gray) {
+                    continue;
+                }
+
+                auto field_object_index = (uint32_t) load_trial_count(field_object, worker.count_map);
+                auto& field_node = nodes[field_object_index];
+                field_node.internal_count++;
+                if (field_node.component == UINT32_MAX) {
+                    //スタック上にあれば同じ成分に属する
+                    nodes[index].lowlink = min(nodes[index].lowlink, field_object_index);
+                } else {
+                    edges.emplace_back(index, field_node.component);
+                }
+            }
+            if (next != UINT32_MAX) {
+                continue;
+            }
+
+            //全てのフィールドを辿り終えれば、成分の始点である場合にスタックから成分を取り出す
+            frames.pop_back();
+            if (nodes[index].lowlink == index) {
+                uint32_t member;
+                do {
+                    member = stack.back();
+                    stack.pop_back();
+                    nodes[member].component = number_of_components;
+                } while (member != index);
+                number_of_components++;
+            }
+            if (!frames.empty()) {
+                auto parent = frames.back().first;
+                if (nodes[index].component == UINT32_MAX) {
+                    nodes[parent].lowlink = min(nodes[parent].lowlink, nodes[index].lowlink);
+                } else {
+                    edges.emplace_back(parent, nodes[index].component);
+                }
+            }
+        }
+    }
+
+    //外からの参照を持つオブジェクトを含む成分を生存しているものとする
+    //参照カウントが0のものは実行スレッドが解放している最中であり、循環参照の一部ではないため同様に扱う
+    auto& is_live = worker.scc_is_live;
+    is_live.assign(number_of_components, false);
+    for (auto& node : nodes) {
+        if (node.ref_count == 0 || node.ref_count != node.internal_count) {
+            is_live[node.component] = true;
+        }
+    }
+
+    //成分の間の参照を参照元の成分毎に並べる
+    auto& edge_begins = worker.scc_edge_begins;
+    auto& edge_targets = worker.scc_edge_targets;
+    edge_begins.assign(number_of_components + 1, 0);
+    for (auto [from, to] : edges) {
+        edge_begins[nodes[from].component + 1]++;
+    }
+    for (uint32_t component = 0; component < number_of_components; component++) {
+        edge_begins[component + 1] += edge_begins[component];
+    }
+    edge_targets.resize(edges.size());
+    for (auto [from, to] : edges) {
+        edge_targets[edge_begins[nodes[from].component]++] = to;
+    }
+    //並べる際に各成分の開始位置を次の成分の開始位置まで進めたため、一つずつ戻す
+    for (auto component = number_of_components; component > 0; component--) {
+        edge_begins[component] = edge_begins[component - 1];
+    }
+    edge_begins[0] = 0;
+
+    //番号の大きい成分から順に、生存している成分から参照される成分へ伝搬させる
+    for (auto component = number_of_components; component-- > 0;) {
+        if (!is_live[component]) {
+            continue;
         }
+        for (auto i = edge_begins[component]; i < edge_begins[component + 1]; i++) {
+            is_live[edge_targets[i]] = true;
+        }
+    }
+
+    for (uint32_t i = 0; i < objects.size(); i++) {
+        objects[i]->set_gc_color(is_live[nodes[i].component] ? object_color::black : object_color::white);
     }
 }
 
@@ -333,36 +2141,31 @@ void mark_black(HeapObject* current_object, unordered_map<HeapObject*, uint8_t>&
 /**
  * 回収可能かどうかをチェック
  */
-bool check_ready_to_collect(HeapObject* current_object, unordered_set<HeapObject*>& acyclic_objects) {
-    //既にチェック済みである場合は無視
-    if (acyclic_objects.find(current_object) != acyclic_objects.end()) {
-        return true;
-    }
+bool check_ready_to_collect(HeapObject* root, unordered_set<HeapObject*>& acyclic_objects, vector<HeapObject*>& mark_stack) {
+    mark_stack.push_back(root);
 
-    //オブジェクトが回収可能であるかどうかをチェック
-    if (!current_object->ready_to_release_with_gc.load(memory_order_acquire)) {
-        return false;
-    }
+    while (!mark_stack.empty()) {
+        auto* current_object = mark_stack.back();
+        mark_stack.pop_back();
 
-    acyclic_objects.insert(current_object);
+        //既にチェック済みである場合は無視
+        if (acyclic_objects.find(current_object) != acyclic_objects.end()) {
+            continue;
+        }
 
-    current_object->lock();
-    
-    //フィールドのオブジェクトが回収可能であるかどうかを再帰的にチェック
-    auto** fields = (HeapObject**) (current_object + 1);
-    size_t field_length = current_object->field_length;
-    for (size_t i = 0; i < field_length; i++) {
-        auto* field_object = fields[i];
-        if (field_object != nullptr) {
-            auto result = check_ready_to_collect(field_object, acyclic_objects);
-            if (!result) {
-                current_object->unlock();
-                return false;
-            }
+        //オブジェクトが回収可能であるかどうかをチェック
+        if (!current_object->is_ready_to_release_with_gc()) {
+            mark_stack.clear();
+            return false;
         }
-    }
 
-    current_object->unlock();
+        acyclic_objects.insert(current_object);
+
+        //実行スレッドによるフィールドの変更を取得するため、ロックを取得している間にフィールドのオブジェクトを積む
+        current_object->lock();
+        push_field_objects(current_object, mark_stack);
+        current_object->unlock();
+    }
 
     return true;
 }
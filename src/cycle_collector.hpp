@@ -4,33 +4,293 @@
 #include <unordered_set>
 #include <vector>
 #include <stack>
+#include <chrono>
 
 #include "heap_object.hpp"
 #include "spin_lock.hpp"
 
 
-extern SpinLock list_lock;
-extern unordered_set<HeapObject*> suspected_object_set;
+/**
+ * スレッド毎の循環参照疑惑のあるオブジェクトのバッファ
+ *
+ * オブジェクトのヘッダの suspect_next を通して繋いだ intrusive なスタックであり、追記する際にメモリを割り当てない。
+ * 一つのオブジェクトが同時に複数のスタックに積まれることは、buffered フラグにより防がれる。
+ * 実行スレッドは自身のバッファへ CAS で積み、コレクタは先頭を交換することで全体を一度に取り出すため、実行スレッドを止めずに回収できる。
+ * スレッドが終了してもバッファ自体は破棄せず、新しく起動したスレッドがそれを引き継ぐ。
+ */
+struct SuspectBuffer {
+    //積まれたオブジェクトのスタックの先頭(空であれば SUSPECT_LIST_END)
+    atomic<HeapObject*> head{SUSPECT_LIST_END};
+    //コレクタサービスへ知らせていない、積まれたオブジェクトの数(バッファを使用しているスレッドのみが操作する)
+    size_t number_of_unnotified = 0;
+    //これまでに積まれたオブジェクトの数(バッファを使用しているスレッドのみが増やし、統計情報として読まれる)
+    atomic_size_t number_of_suspected{0};
+    //生存していると判定された部分グラフのフィールドを変更した回数(バッファを使用しているスレッドのみが増やし、コレクタが世代として読む)
+    atomic<uint64_t> number_of_live_invalidations{0};
+};
+
+
+//現在のスレッドが使用しているバッファ
+inline thread_local SuspectBuffer* current_suspect_buffer = nullptr;
+
+/**
+ * 現在のスレッドにバッファを割り当てる(終了したスレッドのものがあればそれを引き継ぐ)
+ */
+SuspectBuffer* init_suspect_buffer();
+
+
+//コレクタサービスを起こす、一つのバッファへ積まれたオブジェクトの数(停止している間は0)
+extern atomic<size_t> collector_service_wake_threshold;
+
+/**
+ * 回収の間隔を待たずにコレクタサービスを起こす
+ */
+void wake_collector_service();
 
 
+/**
+ * 循環参照疑惑のあるオブジェクトを現在のスレッドのバッファへ積む
+ */
 inline void add_suspected_object(HeapObject* object) {
-    list_lock.lock();
-    suspected_object_set.insert(object);
-    list_lock.unlock();
+    auto* buffer = current_suspect_buffer;
+    if (buffer == nullptr) [[unlikely]] {
+        buffer = init_suspect_buffer();
+    }
+
+    //コレクタが取り出している場合を除き、他のスレッドと競合することはない
+    auto* head = buffer->head.load(memory_order_relaxed);
+    do {
+        object->set_suspect_next(head);
+    } while (!buffer->head.compare_exchange_weak(head, object, memory_order_release, memory_order_relaxed));
+    buffer->number_of_suspected.store(buffer->number_of_suspected.load(memory_order_relaxed) + 1, memory_order_relaxed);
+
+    //コレクタサービスが動いていれば、一定数積む毎に起こす
+    auto wake_threshold = collector_service_wake_threshold.load(memory_order_relaxed);
+    if (wake_threshold != 0 && ++buffer->number_of_unnotified >= wake_threshold) [[unlikely]] {
+        buffer->number_of_unnotified = 0;
+        wake_collector_service();
+    }
 }
 
 
-void gc_collect();
+//コレクタが生存していると判定したルートオブジェクトの判定を、自身で無効にする度に進める世代
+//コレクタは判定した時点の世代(これと各バッファの number_of_live_invalidations の合計)を記録し、世代が進んでいなければ同じ部分グラフを辿り直さない
+extern atomic<uint64_t> gc_live_epoch;
+
+/**
+ * コレクタが生存していると判定した部分グラフに含まれるオブジェクトのフィールドを変更した場合に、世代を進めて判定を無効にする
+ * 実行スレッドがロックを取得してフィールドを変更した後、外したオブジェクトの参照カウントを減らす前に呼び出す
+ * 実行スレッド同士が同じキャッシュラインを奪い合わないよう、全体の世代ではなく自身のバッファの回数を増やす
+ */
+inline void invalidate_live_verdicts(HeapObject* object) {
+    if (object->try_clear_gc_live()) [[unlikely]] {
+        auto* buffer = current_suspect_buffer;
+        if (buffer == nullptr) [[unlikely]] {
+            buffer = init_suspect_buffer();
+        }
+        //書き込むのはこのスレッドのみであるため、fetch_add は不要だが、コレクタが世代を読む操作とは seq_cst で順序付ける
+        buffer->number_of_live_invalidations.store(buffer->number_of_live_invalidations.load(memory_order_relaxed) + 1, memory_order_seq_cst);
+    }
+}
+
+
+/**
+ * 循環参照疑惑のあるオブジェクトとして登録する契機
+ */
+enum suspect_trigger : uint8_t {
+    //参照カウントが1から増えた時(共有された時)に登録する
+    increment_to_shared,
+    //参照カウントを減らして0にならなかった時に登録する(試行削除の本来の契機)
+    decrement_to_nonzero
+};
+
+//現在の登録の契機(set_suspect_trigger を参照)
+extern atomic<suspect_trigger> current_suspect_trigger;
+
+/**
+ * 循環参照疑惑のあるオブジェクトとして登録する契機を設定する(既定は increment_to_shared)
+ *
+ * increment_to_shared は一時的なコピーなどで一瞬共有されただけのオブジェクトも登録するが、
+ * decrement_to_nonzero は循環参照が回収可能になる唯一の契機である、外部からの参照が外された時にのみ登録する。
+ * 登録されたオブジェクトは解放されるまでルートオブジェクトとして残るため、increment_to_shared から decrement_to_nonzero へは
+ * いつでも切り替えられるが、逆の切り替えは循環性のある型のオブジェクトが共有されていない時に行う
+ */
+void set_suspect_trigger(suspect_trigger trigger);
+
+
+/**
+ * 循環参照コレクタの統計情報
+ */
+struct CycleCollectorStats {
+    //バッファへ積まれたオブジェクトの数
+    size_t number_of_suspected = 0;
+    //調べたルートオブジェクトの数(実行スレッド上で参照カウントが0になったものを含む)
+    size_t number_of_traced_roots = 0;
+    //調べたが解放できなかったルートオブジェクトの数(無駄になった探索)
+    size_t number_of_wasted_traces = 0;
+    //フィールドにオブジェクトを持たないため、調べずに残したルートオブジェクトの数
+    size_t number_of_skipped_roots = 0;
+    //以前の回収で生存していると判定してから変更されていないため、辿らずに残したルートオブジェクトの数
+    size_t number_of_cached_roots = 0;
+    //解放したオブジェクトの数
+    size_t number_of_released = 0;
+    //辿るオブジェクトが上限を超えたため、打ち切って後回しにしたルートオブジェクトの数(set_trace_limit を参照)
+    size_t number_of_trace_limit_hits = 0;
+    //打ち切ったルートオブジェクトから辿り、判定せずに元に戻したオブジェクトの数
+    size_t number_of_abandoned_objects = 0;
+};
+
+/**
+ * プロセスの開始からの統計情報を取得する
+ * 回収中でも待たずに取得できるが、各値は同じ時点のものとは限らない
+ */
+CycleCollectorStats get_cycle_collector_stats();
+
+
+/**
+ * 循環参照を回収する
+ * number_of_workers に2以上を指定すると、ルートオブジェクトを分けて複数のスレッドで並列に調べる
+ * 手伝うスレッドは初めて必要になった時に起動し、以降の回収で再利用する
+ */
+void gc_collect(size_t number_of_workers = 1);
+
+/**
+ * gc_collect と同様に循環参照を回収するが、二回以上の回収で解放できなかった古いルートオブジェクトも必ず調べる
+ * gc_collect は生存し続ける循環参照を毎回辿らないように、古いルートオブジェクトを調べる間隔を最大で64回の回収に一度まで延ばすため、
+ * 以前の回収で生存していると判定してから変更されていないルートオブジェクトも辿り直す
+ * 一つのルートオブジェクトから辿るオブジェクトの上限(set_trace_limit)も適用しない
+ * 全ての循環参照を確実に回収したい場合(プログラムの終了時など)に使用する
+ */
+void gc_collect_all(size_t number_of_workers = 1);
+
+/**
+ * 循環参照を少しずつ回収する
+ * ルートオブジェクトを一つずつ調べ、調べたオブジェクトの数が max_objects に達した時点で、ルートオブジェクトの区切りで打ち切る
+ * 調べなかったルートオブジェクトは次の呼び出しへ持ち越され、それらを調べ終えるまでバッファからは新たに取り出さない
+ * 持ち越したルートオブジェクトが残っていなければ true を返す
+ */
+bool gc_collect_step(size_t max_objects);
+
+/**
+ * gc_collect_step と同様に循環参照を少しずつ回収するが、budget の時間が経過した時点で打ち切る
+ * 一つのルートオブジェクトから辿れるオブジェクトを調べている途中では打ち切らないため、budget を超える場合がある
+ */
+bool gc_collect_for(chrono::nanoseconds budget);
+
+/**
+ * 循環参照の検出を、辿るオブジェクトのロックを保持せずに行うかどうかを設定する
+ *
+ * 無効(既定)の場合、mark red phase で辿った全てのオブジェクトのロックを判定が終わるまで保持するため、
+ * 同じオブジェクトのフィールドを書き換える実行スレッドは、辿るオブジェクトの数に比例する時間だけ待たされる。
+ * 有効にすると、ロックを取らずに辿って試行削除を行い、その後に辿った全てのオブジェクトの参照カウントが
+ * mark gray phase で読んだ値から変わっておらず、フィールドも変更されていないことを確かめてから解放する(Bacon らの並行回収における検証と同様)。
+ * 検証に失敗したルートオブジェクトは次の回収で再び調べる。
+ * 有効である間は number_of_workers に関わらず、gc_collect を呼び出したスレッドのみで調べる
+ */
+void set_concurrent_detection(bool is_enabled);
+
+
+/**
+ * 辿った部分グラフから解放できるオブジェクトを判定する方法
+ */
+enum cycle_detection_engine : uint8_t {
+    //試行削除(mark gray / white / black phase)により判定する
+    trial_deletion,
+    //強連結成分に分解し、成分毎に判定する
+    strongly_connected_components
+};
+
+/**
+ * 循環参照の判定方法を設定する(既定は trial_deletion)
+ *
+ * strongly_connected_components は mark red phase で辿った部分グラフを Tarjan の方法で強連結成分に分解し、
+ * 部分グラフの外からの参照を持つ成分と、そこから辿れる成分を生存しているものとして、それ以外の成分を丸ごと解放する。
+ * 判定の結果は試行削除と一致し、複数のルートオブジェクトを含む成分も一度だけ判定する。
+ * 部分グラフを辿るのは mark red phase の後に一度のみであるが、オブジェクト毎の作業用の情報をヘッダの外に持つため、
+ * どちらが速いかはグラフの形による(benchmark_collect_random_graph で比較できる)。
+ * 全てのワーカーで共同して調べるルートオブジェクトは、設定に関わらず試行削除で判定する
+ */
+void set_cycle_detection_engine(cycle_detection_engine engine);
+
+
+/**
+ * 一つのルートオブジェクトから新たに辿るオブジェクトの数と、その大きさ(ヘッダとフィールド)の合計の上限を設定する(0 は上限なし。既定はどちらも0)
+ *
+ * 生存している大きな構造に行き当たったルートオブジェクトは、mark red phase でその全てのロックを取得しながら辿るため、
+ * 停止時間と実行スレッドがロックを待つ時間が構造の大きさに比例する。上限を設定すると、いずれかの上限を超えた時点でそのルートオブジェクトを打ち切り、
+ * 新たに辿った分のロックを解除して、二回以上の回収で解放できなかったものと同様に調べる間隔を空ける古いルートオブジェクトとする。
+ * 古いルートオブジェクトを調べる回収では、上限を超えたものが残る度に上限を倍にして辿り直し、超えずに調べ終えれば元の上限に戻す。
+ * よって上限を超える循環参照もゴミになれば、上限に対する大きさの対数回の古いルートオブジェクトの回収で gc_collect により回収される。
+ * gc_collect_all は上限に関わらず全て辿る。
+ * 並列に回収する場合は、一つのワーカーで辿るには多すぎたルートオブジェクトを全てのワーカーで共同して辿る代わりに上限まで一つのワーカーで辿るが、
+ * 他のワーカーと競合したルートオブジェクトは、これまで通り上限に関わらず共同して辿る
+ */
+void set_trace_limit(size_t max_objects, size_t max_bytes);
+
+
+/**
+ * コレクタサービスの設定
+ */
+struct CollectorServiceOptions {
+    //いずれかのスレッドがバッファへこの数だけ積む毎に、間隔を待たずにコレクタを起こす
+    size_t wake_threshold = 4096;
+    //回収の間隔の下限と上限
+    chrono::microseconds min_interval{100};
+    chrono::microseconds max_interval{100000};
+    //回収に使用するワーカー数(gc_collect を参照)
+    size_t number_of_workers = 1;
+    //0でなければ gc_collect_step にこの数を渡し、停止の要求を確認しながら少しずつ回収する
+    size_t max_objects_per_step = 0;
+    //0以上であれば、コレクタのスレッドをこの番号の CPU に固定する(Linux のみ)
+    int cpu = -1;
+    //true であれば、コレクタのスレッドを SCHED_IDLE で実行する(Linux のみ)
+    bool use_idle_scheduling = false;
+};
+
+/**
+ * バックグラウンドで循環参照を回収するスレッド(コレクタサービス)を起動する
+ * コレクタは回収の間隔だけ待機して回収することを繰り返し、その間にいずれかのスレッドが wake_threshold 個の
+ * オブジェクトをバッファへ積めば、間隔を待たずに回収する。
+ * 回収の間隔は、ルートオブジェクトが増えているか多くを解放できた場合は短く、ルートオブジェクトが無いか殆ど解放できなかった場合は長くする
+ * 既に起動している場合は何もしない
+ */
+void start_collector_service(const CollectorServiceOptions& options = CollectorServiceOptions());
+
+/**
+ * コレクタサービスを停止し、スレッドの終了を待つ
+ * 起動していない場合は何もしない
+ */
+void stop_collector_service();
 
 
 
 /**
  * 循環参照のルートオブジェクトとなり得るかどうかをチェックして登録する
+ * previous_count_word には参照カウントを増やす前の参照カウントのワードを渡す
+ * 循環性のある型は常に is_mutex が true であるため、is_mutex が false の場合は比較のみで除外される
  */
-inline void try_add_suspected_object(HeapObject* object, size_t previous_ref_count) {
-    if (previous_ref_count == 1 && object->is_cyclic_type) {
-        auto expected = false;
-        if (object->buffered.compare_exchange_strong(expected, true, memory_order_relaxed)) {
+inline void try_add_suspected_object(HeapObject* object, uint32_t previous_count_word) {
+    if (previous_count_word == (RC_COUNT_ONE | RC_MUTEX_BIT) && object->is_cyclic_type()
+        && current_suspect_trigger.load(memory_order_relaxed) == suspect_trigger::increment_to_shared) {
+        if (object->try_mark_buffered()) {
+            add_suspected_object(object);
+        }
+    }
+}
+
+
+/**
+ * ローカルでないオブジェクトの参照カウントを減らす前に呼び出し、減らしても0にならない循環性のある型のオブジェクトを登録する
+ * (登録の契機が decrement_to_nonzero の場合のみ)
+ * 減らした後は他のスレッドが解放しうるため、参照を保持している間に登録する。
+ * 他のスレッドが同時に減らして0になった場合は、登録済みであるため drop_object_for_cyclic_type を通してコレクタが解放する
+ */
+inline void try_add_suspected_object_before_decrement(HeapObject* object) {
+    if (current_suspect_trigger.load(memory_order_relaxed) != suspect_trigger::decrement_to_nonzero) [[likely]] {
+        return;
+    }
+    if (object->is_cyclic_type() && object->has_multiple_references()) {
+        if (object->try_mark_buffered()) {
             add_suspected_object(object);
         }
     }
@@ -44,20 +304,20 @@ inline void try_add_suspected_object(HeapObject* object, size_t previous_ref_cou
 inline void drop_object_for_cyclic_type(HeapObject* object) {
     //各フィールドのオブジェクトの参照カウントを一つ減らし、0になればこの関数を再帰的に呼び出す
     object->lock();
+    object->mark_gc_dirty_if_traced();
     auto** fields = (HeapObject**) (object + 1);
-    size_t field_length = object->field_length;
+    size_t field_length = object->get_field_length();
     for (size_t i = 0; i < field_length; i++) {
         auto* field_object = fields[i];
         if (field_object != nullptr) {
             //参照カウントを一つ減らす
-            auto previous_ref_count = ((atomic_size_t*) &field_object->reference_count)->fetch_sub(1, memory_order_release);
-
-            if (previous_ref_count == 1) {
+            try_add_suspected_object_before_decrement(field_object);
+            if (field_object->decrement_ref_count_nonlocal()) {
                 //他のスレッドでの変更を取得
                 atomic_thread_fence(memory_order_acquire);
                 
                 //解放処理の重複を防ぐため、参照を切っておく
-                if (field_object->is_cyclic_type && field_object->buffered.load(memory_order_acquire)) {
+                if (field_object->is_cyclic_type() && field_object->is_buffered(memory_order_acquire)) {
                     fields[i] = nullptr;
                 }
 
@@ -72,5 +332,5 @@ inline void drop_object_for_cyclic_type(HeapObject* object) {
 
     object->unlock();
     //解放可能としてマーク
-    object->ready_to_release_with_gc.store(true, memory_order_release);
+    object->mark_ready_to_release_with_gc();
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "heap_object.hpp"
 #include "cycle_collector.hpp"
+#include "epoch_reclamation.hpp"
 
 
 /**
@@ -22,6 +23,8 @@
  * 
  * 具体的には、オブジェクのヘッダである HeapObject の is_mutex が true である場合、そのオブジェクトが複数のスレッドから
  * アクセスされうることを表し、これを用いてシングルスレッドモードとスレッドセーフモードを動的に切り替える。
+ * (実際には is_mutex をオブジェクト毎のフラグではなく、スレッド毎の世代番号との比較により求めている。
+ *  これにより、アプローチ2.の伝搬をフィールドを辿らずに定数時間で行う。詳細は後述の「伝搬の遅延」を参照)
  * これが通常の load/store と分岐命令で達成可能であることを以下に示す。
  * 
  * 
@@ -92,8 +95,9 @@
  *  2. 次に事柄2.のオブジェクトは、is_mutex が true に変更される前と後で場合分けして考えるのが良い
  *     is_mutex が true に変更される前は、一つのスレッド内でしか操作できないため、この場合に限り同期処理は必要ない。
  *     is_mutex が true にされた後、つまり複数のスレッドからアクセスされうるオブジェクトのフィールドへの挿入処理には排他制御を必要とする[^1]。
- *     この排他制御のうち、オブジェクトを共有する側の unlock の release と読み取る側の lock の acquire により is_mutex の
- *     happens-before-relationship が成立する。
+ *     オブジェクトを共有する側がフィールドへ書き込む際の release と、読み取る側がロックを取らずにフィールドをロードする際の acquire により
+ *     is_mutex の happens-before-relationship が成立する。
+ *     (読み取る側がロックを取らない代わりに、フィールドから外されたオブジェクトの解放はエポックにより遅らせる。"epoch_reclamation.hpp"を参照)
  *     加えてアプローチ4.より、is_mutex はそれ以降書き込まれることはない。
  * 
  * よって、is_mutex が true に変更される前と後、つまりオブジェクトが複数のスレッドからアクセス可能になる前と後で、
@@ -103,10 +107,94 @@
  * 特に、シングルスレッドモードでは一切の同期処理を必要としない。
  * 
  * 
+ * >>> 伝搬の遅延
+ * アプローチ2.をそのまま実装すると、共有するオブジェクトに連なる全てのオブジェクトを辿る必要があり、
+ * 大きなオブジェクトグラフを共有する場合にそのスレッドで大きな停止時間が生じる。
+ * 一方で、伝搬を単純に遅延させて読み取る側のスレッドがフィールドを読む際に is_mutex を立てるようにすると、
+ * 共有したスレッドがまだ手元に持っている参照を通して通常の命令で参照カウントを操作している最中に、
+ * 他のスレッドが同じオブジェクトの is_mutex を書き換えることになり安全ではない。
+ * そこで、is_mutex を「オブジェクトが現在のスレッドのローカルでない」ことと読み替え、次のように求める。
+ * 
+ *  1. 各スレッドは世代番号(current_local_stamp)を持ち、オブジェクトは割り当て時にそのスレッドの世代番号を local_stamp として記録する
+ * 
+ *  2. オブジェクトの local_stamp が現在のスレッドの世代番号と一致する場合のみ、そのオブジェクトはローカル(is_mutex が false)である
+ *     世代番号はスレッド毎に異なるため、他のスレッドが割り当てたオブジェクトは常にローカルでない
+ * 
+ *  3. アプローチ2.の伝搬の代わりに、共有するスレッドは自身の世代を一つ進める
+ *     これにより、そのスレッドがそれまでに割り当てた全てのオブジェクト(共有するオブジェクトに連なるものを含む)が
+ *     フィールドを辿ることなく一度にローカルでなくなる
+ * 
+ * 世代は戻らないため、一度ローカルでなくなったオブジェクトが再びローカルになることはなく、アプローチ4.が成り立つ。
+ * また、世代を進めるのは共有するスレッド自身であり、それ以降そのスレッドはそれまでの参照を通した操作でも atomic な命令を使用するため、
+ * 上記の安全でない状況は起こらない。
+ * 世代番号はスレッド自身のみが読み書きし、オブジェクトの local_stamp を割り当て後に書き換えるのは
+ * どのスレッドの世代番号とも一致しない値にする(ローカルでなくする)場合のみであるため、is_mutex の順序関係についての議論もそのまま成り立つ。
+ * 共有するスレッドよりも後に割り当てたオブジェクトはローカルなままであるため、引き続き同期処理を必要としない。
+ * ただし、共有したスレッドが共有の前に割り当てて手元に残しているオブジェクトも、共有されていなくてもローカルでなくなる。
+ * 
+ * ローカルでなくなったオブジェクトの参照カウントは atomic な命令で操作する。
+ * 割り当てたスレッドが biased モードを有効にしている場合は、そのスレッドが get_object 等で最初に操作する際に遅延して
+ * biased モードへ切り替える("biased_rc.hpp"を参照)。この切り替えと競合しないよう、切り替わる前の参照カウントを減らす場合は CAS を使用する。
+ * 世代を進める方式は、共有するスレッドが手元に残した共有していないオブジェクトまで atomic な命令で操作させるため、
+ * 既定では eager_mutex_propagation を true とし、従来通りフィールドに連なるオブジェクトを辿って伝搬させる(propagate_mutex を参照)。
+ * 世代を進めるのは eager_mutex_propagation を false にしたスレッドのみであり、世代番号を使い切った場合はそのスレッドも辿って伝搬させる。
+ * 
+ * 
  * [^1]: スレッドセーフな参照カウントは『ガベージコレクション 自動的メモリ管理を構成する理論と実装』の
  *       18章「並行参照カウント法」にて取り上げられているロックを用いた単純な並行即時参照カウント法を参考に実装している
  * 
  */
+class DynamicRC;
+
+
+/**
+ * DynamicRC が指すオブジェクトを所有権を持たずに参照するためのハンドル
+ *
+ * with_field を通して一時的にフィールドのオブジェクトを読むために使用する。
+ * 参照カウントを操作しないため、借用元のオブジェクトが生存している間だけ有効である。
+ * 借用中に借用元のフィールドを書き換えてはならない。
+ */
+class BorrowedDynamicRC {
+
+private:
+    //オブジェクト本体へのポインタ(フィールドが空の場合は nullptr)
+    HeapObject* object_ref;
+
+public:
+    inline explicit BorrowedDynamicRC(HeapObject* object_ref) {
+        this->object_ref = object_ref;
+    }
+
+    /**
+     * オブジェクトを参照しているかどうか
+     */
+    inline bool has_value() {
+        return this->object_ref != nullptr;
+    }
+
+    /**
+     * 指定された番号のフィールドにあるオブジェクトを借用し、func に渡して呼び出す
+     * 
+     * このオブジェクトがローカルである場合、単一のスレッドからしかアクセスされないため
+     * func の呼び出し中にフィールドが書き換えられることはなく、参照カウントを一切操作しない。
+     * ローカルでない場合、他のスレッドによる書き換えに備えて get_object と同様に参照カウントを一つ確保し、
+     * 呼び出しの終了時に減らす。optional<DynamicRC> を経由しない分だけ get_object よりも軽量である。
+     * (ロードは get_object と同様にロックを取らずに行う)
+     */
+    template<typename F> inline auto with_field(size_t field_index, F&& func);
+
+    /**
+     * 所有権を持つハンドルを作成する(参照カウントを一つ増やす)
+     */
+    inline optional<DynamicRC> to_owned();
+
+    inline size_t get_reference_count() {
+        return this->object_ref->load_ref_count();
+    }
+
+};
+
+
 class DynamicRC {
 
 private:
@@ -119,31 +207,64 @@ public:
     }
 
     /**
-     * オブジェクトの is_mutex の値を変更して初期化
+     * is_mutex が true であれば、オブジェクトを複数のスレッドからアクセスされうるものとして初期化
      */
     inline DynamicRC(HeapObject* object_ref, bool is_mutex) {
-        object_ref->is_mutex = is_mutex;
+        if (is_mutex) {
+            object_ref->to_mutex();
+        }
         this->object_ref = object_ref;
     }
 
     /**
      * コピーコンストラクタ
      * コピー時に参照カウントを一つ増やす
+     * ムーブ済み(空)のハンドルをコピーした場合は、空のハンドルとなる
      */
     inline DynamicRC(const DynamicRC& rc) {
         auto* object_ref = rc.object_ref;
-        //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-        if (object_ref->is_mutex) {
-            //可能性がある場合、atomic-read-modify-write により参照カウントを一つ増やす
-            auto previous_ref_count = ((atomic_size_t*) &object_ref->reference_count)->fetch_add(1, memory_order_relaxed);
-
-            //必要な場合に、オブジェクトを循環参照コレクタへ渡す
-            try_add_suspected_object(object_ref, previous_ref_count);
-        } else {
-            //そうでない場合は、通常の命令で参照カウントを一つ増やす
-            object_ref->reference_count++;
-        }
         this->object_ref = object_ref;
+        if (object_ref == nullptr) [[unlikely]] {
+            return;
+        }
+        //ローカルであるかどうかに応じて参照カウントを一つ増やす
+        //複数のスレッドからアクセスされる可能性がある場合は atomic-read-modify-write、そうでない場合は通常の命令で増やす
+        auto previous_count_word = object_ref->increment_ref_count_dynamic();
+
+        //必要な場合に、オブジェクトを循環参照コレクタへ渡す
+        try_add_suspected_object(object_ref, previous_count_word);
+    }
+
+    /**
+     * ムーブコンストラクタ
+     * 所有権を移すだけなので参照カウントは変更しない
+     * ムーブ元は空(nullptr)となり、デストラクタでは何もしない
+     * 空のハンドルに対して行えるのは破棄、代入、コピー(空のハンドルとなる)のみであり、
+     * get_object や set_object などのオブジェクトを操作する関数を呼び出してはならない
+     */
+    inline DynamicRC(DynamicRC&& rc) noexcept {
+        this->object_ref = rc.object_ref;
+        rc.object_ref = nullptr;
+    }
+
+    /**
+     * コピー代入演算子
+     */
+    inline DynamicRC& operator=(const DynamicRC& rc) {
+        DynamicRC copy(rc);
+        swap(this->object_ref, copy.object_ref);
+        return *this;
+    }
+
+    /**
+     * ムーブ代入演算子
+     * ムーブ元のオブジェクトの所有権を受け取り、ムーブ元は空(nullptr)となる
+     * 元々保持していたオブジェクトの参照カウントは、デストラクタと同じ処理でこの場で一つ減らす
+     */
+    inline DynamicRC& operator=(DynamicRC&& rc) noexcept {
+        DynamicRC moved(std::move(rc));
+        swap(this->object_ref, moved.object_ref);
+        return *this;
     }
 
     /**
@@ -151,37 +272,77 @@ public:
      * 呼び出される度に参照カウントを一つ減らす
      */
     inline ~DynamicRC() {
-        size_t previous_ref_count;
+        //ムーブ済みの場合は何もしない
+        if (this->object_ref == nullptr) {
+            return;
+        }
 
         //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-        if (this->object_ref->is_mutex) {
+        if (!this->object_ref->is_local()) {
             //可能性がある場合、atomic-read-modify-write により参照カウントを一つ減らす
-            previous_ref_count = ((atomic_size_t*) &this->object_ref->reference_count)->fetch_sub(1, memory_order_release);
-
-            if (previous_ref_count == 1) {
-                //減らした後の参照カウントが0である場合は他のスレッド上での変更を取得
-                atomic_thread_fence(memory_order_acquire);
-
-                //循環参照コレクタに監視されているかどうかをチェック
-                if (this->object_ref->is_cyclic_type && this->object_ref->buffered.load(memory_order_relaxed)) {
-                    //そうである場合は専用の関数で代わりに解放処理を行う
-                    drop_object_for_cyclic_type(this->object_ref);
-                    return;
-                }
+            //biased モードの所有スレッドであれば通常の命令で biased_count を一つ減らす
+            //必要な場合に、減らす前にオブジェクトを循環参照コレクタへ渡す
+            try_add_suspected_object_before_decrement(this->object_ref);
+            if (this->object_ref->decrement_ref_count_nonlocal()) {
+                drop_nonlocal_object(this->object_ref);
             }
-        } else {
-            //そうでない場合は、通常の命令で参照カウントを一つ減らす
-            previous_ref_count = this->object_ref->reference_count--;
+            return;
         }
 
-        if (previous_ref_count != 1) {
+        //そうでない場合は、通常の命令で参照カウントを一つ減らす
+        if (!this->object_ref->decrement_ref_count()) {
             //減らした後の参照カウントが0でない場合は何もしない
             return;
         }
 
-        auto field_length = this->object_ref->field_length;
+        release_fields(this->object_ref);
+        free_heap_object(this->object_ref);
+    }
+
+
+    /**
+     * オブジェクトのヘッダを使用してスピンロック(lock)
+     */
+    inline void lock() {
+        this->object_ref->lock();
+    }
+
+    /**
+     * オブジェクトのヘッダを使用してスピンロック(unlock)
+     */
+    inline void unlock() {
+        this->object_ref->unlock();
+    }
+
+private:
+    /**
+     * 参照カウントが0になったローカルでないオブジェクトを解放する
+     */
+    static inline void drop_nonlocal_object(HeapObject* object) {
+        //減らした後の参照カウントが0である場合は他のスレッド上での変更を取得
+        atomic_thread_fence(memory_order_acquire);
+        //フィールドのオブジェクトの参照カウントを減らす前に、ロックを取らずに辿るコレクタへ知らせる
+        object->mark_gc_dirty_if_traced();
+
+        //循環参照コレクタに監視されているかどうかをチェック
+        if (object->is_cyclic_type() && object->is_buffered(memory_order_relaxed)) {
+            //そうである場合は専用の関数で代わりに解放処理を行う
+            drop_object_for_cyclic_type(object);
+            return;
+        }
+
+        release_fields(object);
+        //ロックを取らずにフィールドを読んでいる他のスレッドがロードしている可能性があるため、解放を遅らせる
+        retire_heap_object(object);
+    }
+
+    /**
+     * 参照カウントが0になったオブジェクトのフィールドに格納されている全オブジェクトの参照カウントを一つ減らす
+     */
+    static inline void release_fields(HeapObject* object) {
+        auto field_length = object->get_field_length();
         //フィールドの開始ポインタ
-        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
+        auto** field_start_ptr = (HeapObject**) (object + 1);
 
         //フィールドに格納されている全オブジェクトの参照カウントを一つ減らす
         for (size_t field_index = 0; field_index < field_length; field_index++) {
@@ -195,83 +356,74 @@ public:
                 DynamicRC rc(field_object);
             }
         }
-
-        free(this->object_ref);
-
-
-        #if RC_VALIDATION
-            //生存しているオブジェクト数を一つ減らす
-            global_object_count.fetch_sub(1, memory_order_relaxed);
-        #endif
     }
 
+public:
+
 
     /**
-     * オブジェクトの spin_lock_flag を使用してスピンロック(lock)
+     * 指定された番号のフィールドにオブジェクト若くは nullptr を挿入
+     * rc は値渡しで受け取った時点で参照カウントが確保されているため、その所有権をそのままフィールドへ移す
      */
-    inline void lock() {
-        while (this->object_ref->spin_lock_flag.test_and_set(memory_order_acquire)) {
-            //spin
+    inline void set_object(size_t field_index, optional<DynamicRC> rc) {
+        //rc が nullopt であれば nullptr
+        //そうでなければオブジェクトの所有権を rc から引き継ぐ
+        HeapObject* object = nullptr;
+        if (rc.has_value()) {
+            object = rc.value().release();
         }
+
+        this->set_object_owned(field_index, object);
     }
 
     /**
-     * オブジェクトの spin_lock_flag を使用してスピンロック(unlock)
+     * 指定された番号のフィールドにオブジェクトを挿入
+     * 右辺値から所有権を引き継ぐため、参照カウントの変更を一切行わない
      */
-    inline void unlock() {
-        this->object_ref->spin_lock_flag.clear(memory_order_release);
+    inline void set_object(size_t field_index, DynamicRC&& rc) {
+        this->set_object_owned(field_index, rc.release());
     }
 
-
-
     /**
-     * 指定された番号のフィールドにオブジェクト若くは nullptr を挿入
+     * 保持しているオブジェクトの所有権を放棄してポインタを返す
+     * 参照カウントは変更しないため、呼び出し側が一つ分の参照カウントを引き継ぐ
      */
-    inline void set_object(size_t field_index, optional<DynamicRC> rc) {
-        //rc が nullopt であれば nullptr
-        //そうでなければオブジェクトへのポインタを取得
-        HeapObject* object = nullptr;
-        if (rc.has_value()) {
-            object = rc.value().object_ref;
-        }
+    inline HeapObject* release() {
+        auto* object_ref = this->object_ref;
+        this->object_ref = nullptr;
+        return object_ref;
+    }
 
+private:
+    /**
+     * 指定された番号のフィールドに、呼び出し側が参照カウントを一つ分確保したオブジェクト若くは nullptr を挿入
+     */
+    inline void set_object_owned(size_t field_index, HeapObject* object) {
         //フィールドの開始ポインタ
         auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
         //対象となるフィールドのポインタ
         auto** field_ptr = field_start_ptr + field_index;
 
-        if (object != nullptr) {
-            //挿入するオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-            if (object->is_mutex) {
-                //可能性がある場合、atomic-read-modify-write により参照カウントを一つ増やす
-                auto previous_ref_count = ((atomic_size_t*) &object->reference_count)->fetch_add(1, memory_order_relaxed);
-
-                //必要な場合に、オブジェクトを循環参照コレクタへ渡す
-                try_add_suspected_object(object, previous_ref_count);
-            } else {
-                //そうでない場合は、通常の命令で参照カウントを一つ増やす
-                object->reference_count++;
-            }
-        }
-        
-
         HeapObject* field_old_object;
 
         //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-        if (this->object_ref->is_mutex) {
+        if (!this->object_ref->is_local()) {
             //可能性がある場合
 
             if (object != nullptr) {
-                //挿入対象のオブジェクト以下のオブジェクト(フィールドに間接的に連なる全てのオブジェクトを含む)の is_mutex を true に伝搬させる
+                //挿入対象のオブジェクト以下のオブジェクト(フィールドに間接的に連なる全てのオブジェクトを含む)をローカルでなくする
+                //世代を進めるだけなのでフィールドは辿らない
                 object->to_mutex();
             }
             
-            //スピンロックを使って安全に入れ替える
-            //この lock によりL266の to_mutex() の結果を acquire できる 
+            //atomic な交換により入れ替える
+            //ロックを取らずに読む側は acquire でロードするため、この release により to_mutex() の結果が見える
+            //読む側はロックを取らないが、循環参照コレクタが辿っている間にフィールドが変わらないよう、書き込む側同士はロックで直列化する
+            //ロックを取らずに辿るコレクタと、生存していると判定したコレクタには、外したオブジェクトの参照カウントを減らす前に変更を知らせる
             this->lock();
-            field_old_object = *field_ptr;
-            *field_ptr = object;
-            //この unlock によりL266の to_mutex() の結果が release される 
+            field_old_object = ((atomic<HeapObject*>*) field_ptr)->exchange(object, memory_order_seq_cst);
+            this->object_ref->mark_gc_dirty_if_traced();
+            invalidate_live_verdicts(this->object_ref);
             this->unlock();
         } else {
             //そうでない場合
@@ -286,6 +438,51 @@ public:
         }
     }
 
+    /**
+     * ローカルでないオブジェクトのフィールドをロックを取らずにロードし、参照カウントを一つ増やして返す
+     *
+     * ロードしてから参照カウントを増やすまでの間に、他のスレッドがフィールドを書き換えて元のオブジェクトを解放する可能性がある。
+     * 解放はエポックにより読み取り中のスレッドが居なくなるまで遅らされるため、ロードしたオブジェクトの領域には常にアクセスできる。
+     * 参照カウントが既に0であれば解放処理が始まっているため、フィールドを読み直す。
+     * 循環参照コレクタは参照カウントが0でないオブジェクトも解放するため、増やした後にフィールドが変わっていないことも確認する。
+     * コレクタは循環性のある型に限らずフィールドに連なる全てのオブジェクトを辿って解放するため、この確認は全てのオブジェクトに対して行う。
+     * フィールドを書き換えたスレッドは、書き換えた後に元のオブジェクトの参照カウントを減らすため、読み直しは必ず終わる。
+     */
+    static inline HeapObject* load_field_nonlocal(HeapObject** field_ptr) {
+        auto* field_atomic = (atomic<HeapObject*>*) field_ptr;
+        EpochGuard epoch_guard;
+
+        while (true) {
+            auto* field_object = field_atomic->load(memory_order_acquire);
+            if (field_object == nullptr) {
+                return nullptr;
+            }
+
+            //このスレッドが割り当てたオブジェクトであれば、ここで biased モードへ切り替えられる
+            uint32_t previous_count_word;
+            if (!field_object->try_increment_ref_count_nonlocal(previous_count_word)) {
+                continue;
+            }
+
+            if (field_atomic->load(memory_order_acquire) != field_object) [[unlikely]] {
+                //フィールドから外された後に増やしてしまった場合は元に戻す
+                //外されたオブジェクトはコレクタが解放しようとしている可能性があるため、循環参照コレクタへ渡さずに減らす
+                //コレクタが解放するオブジェクトには内部からの参照が残っているため、ここで0になるのは外したスレッドの減算より後に戻した場合のみである
+                if (field_object->decrement_ref_count_nonlocal()) {
+                    drop_nonlocal_object(field_object);
+                }
+                continue;
+            }
+
+            //必要な場合に、オブジェクトを循環参照コレクタへ渡す
+            try_add_suspected_object(field_object, previous_count_word);
+            return field_object;
+        }
+    }
+
+    friend class BorrowedDynamicRC;
+
+public:
 
     /**
      * 指定された番号のフィールドにあるオブジェクトを取得
@@ -300,40 +497,21 @@ public:
         HeapObject* field_object;
 
         //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-        if (this->object_ref->is_mutex) {
+        if (!this->object_ref->is_local()) {
             //可能性がある場合
-            //スピンロックを使用して以下の操作を不可分的に行う
-            // 1. フィールドからロード
-            // 2. ロードしたオブジェクトの参照カウントを一つ増やす
-            //オブジェクトの削除処理との順序関係を確定させるために不可分操作を要する
-            //この lock によりL266の to_mutex() の結果を acquire できる 
-            this->lock();
-            field_object = *field_ptr;
-            if (field_object != nullptr) {
-                //this->object_ref の is_mutex が true であり、
-                //アプローチ2.より field_object の is_mutex が true であることがわかるためチェックする必要はない
-                auto previous_ref_count = ((atomic_size_t*) &field_object->reference_count)->fetch_add(1, memory_order_relaxed);
-
-                //必要な場合に、オブジェクトを循環参照コレクタへ渡す
-                try_add_suspected_object(field_object, previous_ref_count);
-            }
-            this->unlock();
+            //ロックを取らずにロードし、生存している場合のみ参照カウントを一つ増やす
+            //this->object_ref がローカルでなく、アプローチ2.より field_object もローカルでないことがわかる
+            field_object = load_field_nonlocal(field_ptr);
         } else {
             //そうでない場合
             //通常の命令で取得する
             field_object = *field_ptr;
             if (field_object != nullptr) {
-                //取得したオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-                if (field_object->is_mutex) {
-                    //可能性がある場合、atomic-read-modify-write により参照カウントを一つ増やす
-                    auto previous_ref_count = ((atomic_size_t*) &field_object->reference_count)->fetch_add(1, memory_order_relaxed);
-
-                    //必要な場合に、オブジェクトを循環参照コレクタへ渡す
-                    try_add_suspected_object(field_object, previous_ref_count);
-                } else {
-                    //そうでない場合は、通常の命令で参照カウントを一つ増やす
-                    field_object->reference_count++;
-                }
+                //取得したオブジェクトがローカルであるかどうかに応じて参照カウントを一つ増やす
+                auto previous_count_word = field_object->increment_ref_count_dynamic();
+
+                //必要な場合に、オブジェクトを循環参照コレクタへ渡す
+                try_add_suspected_object(field_object, previous_count_word);
             }
         }
 
@@ -348,17 +526,79 @@ public:
         this->object_ref->to_mutex();
     }
 
+    /**
+     * 循環性のある型としてマークし、共有されたものとして記録する
+     * to_mutex と異なり世代を進めないため、現在のスレッドがそれまでに割り当てた他のオブジェクトはローカルなまま残る
+     * (割り当てた直後に呼び出す場合はフィールドが空であるため、このオブジェクトのみを記録する)
+     */
     inline void mark_as_cyclic_type() {
-        this->object_ref->is_cyclic_type = true;
-        this->object_ref->is_mutex = true;
+        this->object_ref->set_cyclic_type();
+        if (this->object_ref->is_local()) {
+            //フィールドに連なるローカルなオブジェクトも共有されたものとして記録し、アプローチ2.を保つ
+            //循環性のある型は biased モードにならないため、このオブジェクトは RC_MUTEX_BIT と LOCAL_STAMP_SHARED のみを記録する
+            propagate_mutex(this->object_ref);
+        } else {
+            //循環参照コレクタは RC_MUTEX_BIT が立っているオブジェクトのみを監視するため、既にローカルでなくても立てておく
+            this->object_ref->set_mutex(true);
+        }
     }
 
     inline size_t get_reference_count() {
-        if (this->object_ref->is_mutex) {
-            return ((atomic_size_t*) &this->object_ref->reference_count)->load(memory_order_relaxed);
-        } else {
-            return this->object_ref->reference_count;
-        }
+        return this->object_ref->load_ref_count();
+    }
+
+    /**
+     * このオブジェクトを所有権を持たずに参照するハンドルを作成する
+     */
+    inline BorrowedDynamicRC borrow() {
+        return BorrowedDynamicRC(this->object_ref);
+    }
+
+    /**
+     * 指定された番号のフィールドにあるオブジェクトを借用し、func に渡して呼び出す
+     * 詳細は BorrowedDynamicRC::with_field を参照
+     */
+    template<typename F> inline auto with_field(size_t field_index, F&& func) {
+        return this->borrow().with_field(field_index, std::forward<F>(func));
     }
 
 };
+
+
+template<typename F> inline auto BorrowedDynamicRC::with_field(size_t field_index, F&& func) {
+    //フィールドの開始ポインタ
+    auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
+    //対象となるフィールドのポインタ
+    auto** field_ptr = field_start_ptr + field_index;
+
+    //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
+    if (this->object_ref->is_local()) {
+        //可能性がない場合は、フィールドの内容をそのまま貸し出す
+        return func(BorrowedDynamicRC(*field_ptr));
+    }
+
+    //可能性がある場合は get_object と同様にロックを取らずにロードして参照カウントを一つ増やす
+    //借用中に他のスレッドが同じオブジェクトへの参照を増やした場合に備えて、get_object と同様に循環参照コレクタへ渡す
+    auto* field_object = DynamicRC::load_field_nonlocal(field_ptr);
+
+    //呼び出しが終わった時点で確保した参照カウントを一つ減らす
+    //field_object が nullptr の場合、デストラクタは何もしない
+    DynamicRC guard(field_object);
+
+    return func(BorrowedDynamicRC(field_object));
+}
+
+
+inline optional<DynamicRC> BorrowedDynamicRC::to_owned() {
+    if (this->object_ref == nullptr) {
+        return nullopt;
+    }
+
+    //ローカルであるかどうかに応じて参照カウントを一つ増やす
+    auto previous_count_word = this->object_ref->increment_ref_count_dynamic();
+
+    //必要な場合に、オブジェクトを循環参照コレクタへ渡す
+    try_add_suspected_object(this->object_ref, previous_count_word);
+
+    return DynamicRC(this->object_ref);
+}
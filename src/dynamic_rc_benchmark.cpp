@@ -7,6 +7,7 @@
 #include <thread>
 #include <benchmark/benchmark.h>
 #include <functional>
+#include <random>
 
 //全オブジェクトのフィールドの長さ
 #define OBJECT_FIELD_LENGTH 2
@@ -14,6 +15,24 @@
 //マルチスレッドベンチマークに使用するスレッド数
 #define NUMBER_OF_THREADS 8
 
+//benchmark_parallel_collect で一度に回収する循環参照の数
+#define PARALLEL_COLLECT_CYCLES 16384
+
+//benchmark_collect_big_graph で作成する二分木のオブジェクト数
+#define BIG_GRAPH_OBJECTS (1 << 18)
+
+//benchmark_collect_with_live_cycles で一度に回収する循環参照の数
+#define GARBAGE_CYCLES_PER_COLLECTION 256
+
+//benchmark_store_into_traced_objects で生存させる循環参照の数
+#define TRACED_STORE_CYCLES (1 << 16)
+
+//benchmark_collect_random_graph で作成するオブジェクトの数
+#define RANDOM_GRAPH_OBJECTS (1 << 16)
+
+//benchmark_collect_with_trace_limit で生存させる環状の構造のオブジェクト数
+#define TRACE_LIMIT_GRAPH_OBJECTS (1 << 16)
+
 
 #if RC_VALIDATION
     atomic_size_t global_object_count;
@@ -69,9 +88,137 @@ static void benchmark_multithread_with_non_gc(benchmark::State& state);
 
 /**
  * 循環参照コレクタの速度評価用ベンチマーク (GC時)
+ * 1秒あたりにバッファへ積まれたオブジェクトの数を suspects_per_second、一回あたりに解放できなかったルートオブジェクトを調べた回数を wasted_traces として記録する
  */
 static void benchmark_multithread_with_gc(benchmark::State& state);
 
+/**
+ * 循環参照疑惑のあるオブジェクトを参照カウントを減らした時に登録して benchmark_multithread_with_gc を実行する
+ */
+static void benchmark_multithread_with_gc_decrement_trigger(benchmark::State& state);
+
+/**
+ * 指定されたアロケータを使用して既存のベンチマーク用関数を実行する
+ */
+static void benchmark_with_allocator(benchmark::State& state, void (*benchmark_func)(benchmark::State&), uint8_t allocator_id);
+
+/**
+ * 作成済みの木構造オブジェクトを get_object で読み取りのみ行いながら辿るベンチマーク用関数
+ * state.range(0) が 1 の場合は木構造を予め mutex 化しておく
+ */
+static void benchmark_walk_tree_with_get_object(benchmark::State& state);
+
+/**
+ * 作成済みの木構造オブジェクトを with_field で借用しながら辿るベンチマーク用関数
+ * state.range(0) が 1 の場合は木構造を予め mutex 化しておく
+ */
+static void benchmark_walk_tree_with_borrow(benchmark::State& state);
+
+/**
+ * 手元に保持している木構造オブジェクトとは無関係な小さなオブジェクトを共有した後に、木構造を get_object で辿るベンチマーク用関数
+ * to_mutex で世代を進めることで、共有していない木構造がローカルでなくなる影響を計測する
+ * state.range(0) は伝搬方法(0 : 世代を進める, 1 : 即座に伝搬させる)
+ */
+static void benchmark_walk_tree_after_publish(benchmark::State& state);
+
+/**
+ * 共有した木構造オブジェクトを共有元のスレッドが主に辿り、他のスレッドが時折辿るベンチマーク用関数
+ * state.range(0) が 1 の場合は共有元のスレッドで biased モードを使用する
+ */
+static void benchmark_multi_thread_dominant_owner(benchmark::State& state);
+
+/**
+ * 作成済みのオブジェクトグラフをグローバル変数へ渡す(共有する)処理のみを計測するベンチマーク用関数
+ * state.range(0) はグラフの形状(0 : 連結リスト, 1 : 二分木, 2 : DAG)
+ * state.range(1) はオブジェクト数の2を底とする対数
+ * state.range(2) は伝搬方法(0 : 世代を進める, 1 : 即座に伝搬させる, 2 : 即座に並列に伝搬させる)
+ */
+static void benchmark_publish_graph(benchmark::State& state);
+
+/**
+ * benchmark_publish_graph の引数の組み合わせを登録する
+ * 連結リストはデストラクタの再帰が深くなりすぎないよう小さなものに限る
+ */
+static void publish_graph_arguments(benchmark::internal::Benchmark* benchmark);
+
+/**
+ * 複数のスレッドからグローバル変数のフィールドを get_object で読み続けるベンチマーク用関数
+ * state.range(0) が 1 の場合は一つのスレッドが同じフィールドを書き換え続ける
+ */
+static void benchmark_multi_thread_read_global(benchmark::State& state);
+
+/**
+ * 複数のスレッドが循環参照疑惑のあるオブジェクトを登録し続け、gc thread がそれを回収するベンチマーク用関数
+ * state.range(0) は実行スレッド数(NUMBER_OF_THREADS を超える数も含む)
+ * state.range(1) が0の場合は gc_collect を呼び続けるスレッド、1の場合はコレクタサービスが回収する
+ * コレクタの使用する CPU 時間を含めて比較するため、プロセス全体の CPU 時間を計測する
+ */
+static void benchmark_suspect_scaling(benchmark::State& state);
+
+/**
+ * 長い循環リストを一つ作成し、gc_collect で回収する処理のみを計測するベンチマーク用関数
+ * state.range(0) はオブジェクト数の2を底とする対数
+ */
+static void benchmark_collect_long_cycle(benchmark::State& state);
+
+/**
+ * 互いに独立した多数の循環参照を作成し、gc_collect で回収する処理のみを計測するベンチマーク用関数
+ * state.range(0) は回収に使用するワーカー数
+ */
+static void benchmark_parallel_collect(benchmark::State& state);
+
+/**
+ * 全ての葉が根を参照する大きな二分木を一つ作成し、gc_collect で回収する処理のみを計測するベンチマーク用関数
+ * ルートオブジェクトは根のみであるため、一つの部分グラフを複数のワーカーで共同して辿ることになる
+ * state.range(0) は回収に使用するワーカー数
+ */
+static void benchmark_collect_big_graph(benchmark::State& state);
+
+/**
+ * benchmark_parallel_collect と同じ循環参照を、gc_collect_step を繰り返し呼び出して回収する処理のみを計測するベンチマーク用関数
+ * 一回の呼び出しにかかった最長の時間を max_step_us として記録する
+ * state.range(0) は一回の呼び出しで調べるオブジェクト数の上限
+ */
+static void benchmark_collect_step(benchmark::State& state);
+
+/**
+ * benchmark_collect_big_graph と同じ二分木を生存させたまま gc_collect で調べ続け、その間に別のスレッドが
+ * 葉のフィールドを書き換える時間の最長値を max_stall_us として記録するベンチマーク用関数
+ * state.range(0) が0の場合は辿るオブジェクトのロックを保持し、1の場合はロックを取らずに検出する(set_concurrent_detection)
+ */
+static void benchmark_mutator_stall(benchmark::State& state);
+
+/**
+ * 生存し続ける循環参照を保持したまま、少数の循環参照を作成して gc_collect で回収する処理のみを計測するベンチマーク用関数
+ * 生存している循環参照のルートオブジェクトは古いルートオブジェクトとなるため、毎回は辿られない
+ * 古いルートオブジェクトを調べる回収でも、生存していると判定してから変更されていないものは辿られず、その数を cached_roots として記録する
+ * state.range(0) は生存させる循環参照の数
+ */
+static void benchmark_collect_with_live_cycles(benchmark::State& state);
+
+/**
+ * 回収で生存していると判定された循環参照のオブジェクトへ、複数のスレッドから分担してフィールドを書き込む処理のみを計測するベンチマーク用関数
+ * 判定した部分グラフから辿ったオブジェクトへの最初の書き込みは、判定を無効にするために世代を進める
+ * state.range(0) は書き込むスレッドの数
+ */
+static void benchmark_store_into_traced_objects(benchmark::State& state);
+
+/**
+ * 強連結成分の大きさを揃えた乱数のグラフを作成し、gc_collect で回収する処理のみを計測するベンチマーク用関数
+ * 各成分は環状に繋いだ上で成分内へ乱数で参照を加え、成分の間の参照は後に作成した成分へのみ向けるため、強連結成分の大きさは state.range(0) となる
+ * 4つに1つの成分は外部から参照したまま残し、そこから辿れる成分と共に生存させる
+ * state.range(1) が0の場合は試行削除、1の場合は強連結成分への分解により判定する(set_cycle_detection_engine)
+ */
+static void benchmark_collect_random_graph(benchmark::State& state);
+
+/**
+ * 生存している大きな環状の構造を参照するルートオブジェクトと少数の循環参照を毎回作成し、gc_collect で回収する処理のみを計測するベンチマーク用関数
+ * 上限を設定しない場合は新たなルートオブジェクトから毎回構造の全てを辿るが、設定した場合は上限で打ち切って後回しにする
+ * 打ち切ったルートオブジェクトの数を trace_limit_hits として記録する
+ * state.range(0) は一つのルートオブジェクトから辿るオブジェクトの数の上限(0 は上限なし。set_trace_limit)
+ */
+static void benchmark_collect_with_trace_limit(benchmark::State& state);
+
 
 //各種ベンチマーク関数の登録
 //詳細は以下を参照
@@ -84,6 +231,41 @@ BENCHMARK(benchmark_multi_thread_thread_safe_rc);
 BENCHMARK(benchmark_multi_thread_dynamic_rc);
 BENCHMARK(benchmark_multithread_with_non_gc);
 BENCHMARK(benchmark_multithread_with_gc);
+BENCHMARK(benchmark_multithread_with_gc_decrement_trigger);
+BENCHMARK(benchmark_walk_tree_with_get_object)->Arg(0)->Arg(1);
+BENCHMARK(benchmark_walk_tree_with_borrow)->Arg(0)->Arg(1);
+BENCHMARK(benchmark_walk_tree_after_publish)->Arg(0)->Arg(1);
+BENCHMARK(benchmark_multi_thread_dominant_owner)->Arg(0)->Arg(1);
+BENCHMARK(benchmark_publish_graph)->Apply(publish_graph_arguments)->Iterations(10)->UseRealTime();
+BENCHMARK(benchmark_multi_thread_read_global)->Arg(0)->Arg(1)->UseRealTime();
+BENCHMARK(benchmark_suspect_scaling)->ArgsProduct({benchmark::CreateRange(1, 4 * NUMBER_OF_THREADS, 2), {0, 1}})->MeasureProcessCPUTime()->UseRealTime();
+BENCHMARK(benchmark_collect_long_cycle)->DenseRange(10, 20, 5);
+BENCHMARK(benchmark_parallel_collect)->RangeMultiplier(2)->Range(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK(benchmark_collect_big_graph)->RangeMultiplier(2)->Range(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK(benchmark_collect_step)->RangeMultiplier(16)->Range(256, 65536);
+BENCHMARK(benchmark_mutator_stall)->Arg(0)->Arg(1)->UseRealTime();
+BENCHMARK(benchmark_collect_with_live_cycles)->RangeMultiplier(8)->Range(1 << 8, 1 << 17);
+BENCHMARK(benchmark_store_into_traced_objects)->RangeMultiplier(2)->Range(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK(benchmark_collect_random_graph)->ArgsProduct({{2, 16, 256, 4096}, {0, 1}});
+BENCHMARK(benchmark_collect_with_trace_limit)->Arg(0)->Arg(1024);
+
+//アロケータ毎のベンチマーク関数の登録
+BENCHMARK_CAPTURE(benchmark_with_allocator, single_thread_manual_object_malloc, benchmark_single_thread_manual_object, MALLOC_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, single_thread_single_thread_rc_malloc, benchmark_single_thread_single_thread_rc, MALLOC_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, single_thread_thread_safe_rc_malloc, benchmark_single_thread_thread_safe_rc, MALLOC_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, single_thread_dynamic_rc_malloc, benchmark_single_thread_dynamic_rc, MALLOC_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, multi_thread_thread_safe_rc_malloc, benchmark_multi_thread_thread_safe_rc, MALLOC_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, multi_thread_dynamic_rc_malloc, benchmark_multi_thread_dynamic_rc, MALLOC_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, multithread_with_non_gc_malloc, benchmark_multithread_with_non_gc, MALLOC_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, multithread_with_gc_malloc, benchmark_multithread_with_gc, MALLOC_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, single_thread_manual_object_counting, benchmark_single_thread_manual_object, COUNTING_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, single_thread_single_thread_rc_counting, benchmark_single_thread_single_thread_rc, COUNTING_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, single_thread_thread_safe_rc_counting, benchmark_single_thread_thread_safe_rc, COUNTING_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, single_thread_dynamic_rc_counting, benchmark_single_thread_dynamic_rc, COUNTING_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, multi_thread_thread_safe_rc_counting, benchmark_multi_thread_thread_safe_rc, COUNTING_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, multi_thread_dynamic_rc_counting, benchmark_multi_thread_dynamic_rc, COUNTING_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, multithread_with_non_gc_counting, benchmark_multithread_with_non_gc, COUNTING_HEAP_ALLOCATOR_ID);
+BENCHMARK_CAPTURE(benchmark_with_allocator, multithread_with_gc_counting, benchmark_multithread_with_gc, COUNTING_HEAP_ALLOCATOR_ID);
 
 //複数のスレッドから直接アクセス可能なオブジェクト
 ThreadSafeRC global_variable_with_thread_safe_rc(alloc_heap_object(OBJECT_FIELD_LENGTH));
@@ -95,6 +277,121 @@ size_t get_clock_time() {
 }
 
 
+#if RC_VALIDATION
+/**
+ * 循環参照を作成し続ける実行スレッドと、collect を繰り返し呼び出す回収スレッドを走らせ、グローバル変数から全て外す
+ * is_biased が true の場合、実行スレッドは biased モードで循環性の無い木構造も共有する
+ * number_of_steps は各実行スレッドが操作を繰り返す回数
+ */
+template<typename F> void run_cycle_collection_workload(F collect, bool is_biased, size_t number_of_steps) {
+    //予め全てのフィールドにオブジェクトをセット
+    for (size_t i = 0; i < 10; i++) {
+        DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+        object.mark_as_cyclic_type();
+        global_variable_with_dynamic_rc.set_object(i, object);
+    }
+
+    //gc threadを停止するかどうか
+    atomic_bool is_finished(false);
+
+    //実行スレッド側の処理
+    auto mutator_func = [is_biased, number_of_steps](atomic_bool& is_finished) {
+        enable_biased_rc(is_biased);
+
+        for (size_t s = 0; s < number_of_steps; s++) {
+            //適度に循環参照を作成する
+            if (get_clock_time() % 2 == 0) {
+                DynamicRC obj1(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                DynamicRC obj2(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                DynamicRC obj3(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                obj1.mark_as_cyclic_type();
+                obj2.mark_as_cyclic_type();
+                obj3.mark_as_cyclic_type();
+
+                //biased モードでは、このスレッドを所有スレッドとする木構造を他のスレッドが手放すようにする
+                if (is_biased) {
+                    obj1.set_object(get_clock_time() % 2, create_tree<DynamicRC>(0, 2));
+                }
+
+                global_variable_with_dynamic_rc.set_object(get_clock_time(), obj1);
+                global_variable_with_dynamic_rc.set_object(get_clock_time(), obj2);
+                global_variable_with_dynamic_rc.set_object(get_clock_time(), obj3);
+            } else {
+                auto obj1 = global_variable_with_dynamic_rc.get_object(get_clock_time()).value();
+                auto obj2 = global_variable_with_dynamic_rc.get_object(get_clock_time()).value();
+                auto obj3 = global_variable_with_dynamic_rc.get_object(get_clock_time()).value();
+
+                if (get_clock_time() % 2 == 0) {
+                    obj1.set_object(get_clock_time() % 2, obj2);
+                    obj2.set_object(get_clock_time() % 2, obj3);
+                } else {
+                    obj1.set_object(get_clock_time() % 2, obj2);
+                    obj2.set_object(get_clock_time() % 2, obj3);
+                    obj3.set_object(get_clock_time() % 2, obj1);
+                }
+            }
+        }
+
+        //gc threadへ向けて終了シグナルを送信
+        is_finished.store(true, memory_order_relaxed);
+    };
+
+    vector<thread> threads;
+    //スレッド起動
+    for (size_t i = 0; i < NUMBER_OF_THREADS - 1; i++) {
+        threads.push_back(thread(mutator_func, ref(is_finished)));
+    }
+
+    //gc thread 側の処理
+    auto gc_func = [&collect](atomic_bool& is_finished) {
+        //終了シグナルが送信されるまで、gcを走らせ続ける
+        while (!is_finished.load(memory_order_relaxed)) {
+            collect();
+        }
+    };
+    threads.push_back(thread(gc_func, ref(is_finished)));
+
+    //スレッド終了待機
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+
+    //グローバル変数へ挿入されているオブジェクトを削除
+    for (size_t i = 0; i < 10; i++) {
+        global_variable_with_dynamic_rc.set_object(i, nullopt);
+    }
+}
+
+
+/**
+ * 全て回収した後に、生存しているオブジェクトが残っていないかどうかを返す
+ * 他のスレッドが退避したオブジェクトはそのスレッドの終了後に解放されるため、回収を行うスレッドを全て終了させてから呼び出す
+ */
+bool validate_all_released(const char* name) {
+    //一度で全て回収しきれないことがあるので何度も呼び出す
+    for (size_t i = 0; i < 5; i++) {
+        gc_collect_all();
+    }
+
+    //解放を遅らせているオブジェクトを全て解放する
+    reclaim_retired_objects();
+
+    auto object_count = global_object_count.load(memory_order_relaxed);
+    cout << name << " : object count " << object_count << endl;
+    return object_count == 0;
+}
+
+
+/**
+ * run_cycle_collection_workload を実行し、生存しているオブジェクトが残っていないかどうかを返す
+ */
+template<typename F> bool validate_cycle_collection(const char* name, F collect, bool is_biased, size_t number_of_steps) {
+    run_cycle_collection_workload(collect, is_biased, number_of_steps);
+    return validate_all_released(name);
+}
+#endif
+
+
 #if RC_VALIDATION
 int main() {
     //L74 - L75で作成したオブジェクトのカウントをリセット
@@ -118,7 +415,7 @@ int main() {
                 //木構造オブジェクトを作成
                 auto tree = create_tree<ThreadSafeRC>(0, 10);
                 //グローバル変数へ渡す
-                global_variable_with_thread_safe_rc.set_object(0, tree);
+                global_variable_with_thread_safe_rc.set_object(0, std::move(tree));
             }
         };
         vector<thread> threads;
@@ -140,7 +437,7 @@ int main() {
                 //木構造オブジェクトを作成
                 auto tree = create_tree<DynamicRC>(0, 10);
                 //グローバル変数へ渡す
-                global_variable_with_dynamic_rc.set_object(0, tree);
+                global_variable_with_dynamic_rc.set_object(0, std::move(tree));
             }
         };
         vector<thread> threads;
@@ -156,91 +453,53 @@ int main() {
         global_variable_with_dynamic_rc.set_object(0, nullopt);
     }
 
-    {
-        //予め全てのフィールドにオブジェクトをセット
-        for (size_t i = 0; i < 10; i++) {
-            DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
-            object.mark_as_cyclic_type();
-            global_variable_with_dynamic_rc.set_object(i, object);
-        }
+    //循環参照コレクタの各モードで回収し、その都度生存しているオブジェクトが残っていないことを確かめる
+    bool is_valid = true;
 
-        //gc threadを停止するかどうか
-        atomic_bool is_finished(false);
+    is_valid &= validate_cycle_collection("gc_collect", []() { gc_collect(); }, false, 100000);
 
-        //実行スレッド側の処理
-        auto mutator_func = [](atomic_bool& is_finished) {
-            for (size_t s = 0; s < 100000; s++) {
-                //適度に循環参照を作成する
-                if (get_clock_time() % 2 == 0) {
-                    DynamicRC obj1(alloc_heap_object(OBJECT_FIELD_LENGTH));
-                    DynamicRC obj2(alloc_heap_object(OBJECT_FIELD_LENGTH));
-                    DynamicRC obj3(alloc_heap_object(OBJECT_FIELD_LENGTH));
-                    obj1.mark_as_cyclic_type();
-                    obj2.mark_as_cyclic_type();
-                    obj3.mark_as_cyclic_type();
-                    
-                    global_variable_with_dynamic_rc.set_object(get_clock_time(), obj1);
-                    global_variable_with_dynamic_rc.set_object(get_clock_time(), obj2);
-                    global_variable_with_dynamic_rc.set_object(get_clock_time(), obj3);
-                } else {
-                    auto obj1 = global_variable_with_dynamic_rc.get_object(get_clock_time()).value();
-                    auto obj2 = global_variable_with_dynamic_rc.get_object(get_clock_time()).value();
-                    auto obj3 = global_variable_with_dynamic_rc.get_object(get_clock_time()).value();
+    is_valid &= validate_cycle_collection("gc_collect (parallel)", []() { gc_collect(NUMBER_OF_THREADS / 2); }, false, 20000);
 
-                    if (get_clock_time() % 2 == 0) {
-                        obj1.set_object(get_clock_time() % 2, obj2);
-                        obj2.set_object(get_clock_time() % 2, obj3);
-                    } else {
-                        obj1.set_object(get_clock_time() % 2, obj2);
-                        obj2.set_object(get_clock_time() % 2, obj3);
-                        obj3.set_object(get_clock_time() % 2, obj1);
-                    }
-                }
-            }
+    is_valid &= validate_cycle_collection("gc_collect_step", []() { gc_collect_step(256); }, false, 20000);
 
-            //gc threadへ向けて終了シグナルを送信
-            is_finished.store(true, memory_order_relaxed);
-        };
+    is_valid &= validate_cycle_collection("gc_collect_for", []() { gc_collect_for(chrono::microseconds(100)); }, false, 20000);
 
-        vector<thread> threads;
-        //スレッド起動
-        for (size_t i = 0; i < NUMBER_OF_THREADS - 1; i++) {
-            threads.push_back(thread(mutator_func, ref(is_finished)));
-        }
+    set_concurrent_detection(true);
+    is_valid &= validate_cycle_collection("concurrent detection", []() { gc_collect(); }, false, 20000);
+    set_concurrent_detection(false);
 
-        //gc thread 側の処理
-        auto gc_func = [](atomic_bool& is_finished) {
-            //終了シグナルが送信されるまで、gcを走らせ続ける
-            while (!is_finished.load(memory_order_relaxed)) {
-                gc_collect();
-            }
-        };
-        threads.push_back(thread(gc_func, ref(is_finished)));
+    set_cycle_detection_engine(cycle_detection_engine::strongly_connected_components);
+    is_valid &= validate_cycle_collection("strongly connected components", []() { gc_collect(); }, false, 20000);
+    set_cycle_detection_engine(cycle_detection_engine::trial_deletion);
 
-        //スレッド終了待機
-        for (auto it = threads.begin(); it != threads.end(); ++it) {
-            it->join();
-        }
+    set_trace_limit(16, 0);
+    is_valid &= validate_cycle_collection("trace limit", []() { gc_collect(); }, false, 20000);
+    is_valid &= validate_cycle_collection("trace limit (parallel)", []() { gc_collect(NUMBER_OF_THREADS / 2); }, false, 20000);
+    set_trace_limit(0, 0);
 
-        //グローバル変数へ挿入されているオブジェクトを削除
-        for (size_t i = 0; i < 10; i++) {
-            global_variable_with_dynamic_rc.set_object(i, nullopt);
-        }
-        
-        //一度で全て回収しきれないことがあるので何度も呼び出す
-        cout << "start collect" << endl;
-        gc_collect();
-        gc_collect();
-        gc_collect();
-        gc_collect();
-        gc_collect();
-        cout << "end collect" << endl;
-    }
+    //回収スレッドは何もせず、コレクタサービスに回収させる
+    CollectorServiceOptions service_options;
+    service_options.number_of_workers = 3;
+    service_options.max_objects_per_step = 256;
+    start_collector_service(service_options);
+    run_cycle_collection_workload([]() { this_thread::sleep_for(chrono::milliseconds(1)); }, false, 20000);
+    stop_collector_service();
+    is_valid &= validate_all_released("collector service");
+
+    is_valid &= validate_cycle_collection("biased", []() { gc_collect(); }, true, 20000);
+
+    //全て回収した後であれば、循環性のある型のオブジェクトは共有されていないため契機を戻せる
+    set_suspect_trigger(suspect_trigger::decrement_to_nonzero);
+    is_valid &= validate_cycle_collection("decrement_to_nonzero", []() { gc_collect(); }, false, 20000);
+    set_suspect_trigger(suspect_trigger::increment_to_shared);
+
+    //解放を遅らせているオブジェクトを全て解放する
+    reclaim_retired_objects();
 
     //現在生存しているオブジェクト数を表示(0以外は不正)
     cout << "Global object count : " << global_object_count.load(memory_order_relaxed) << endl;
 
-    return 0;
+    return is_valid && global_object_count.load(memory_order_relaxed) == 0 ? 0 : 1;
 }
 #else
 //ベンチマークを走らせる
@@ -265,7 +524,8 @@ template<typename T> T create_tree(size_t count, size_t tree_depth) {
 
     for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
         auto child = create_tree<T>(count + 1, tree_depth);
-        object.set_object(i, child);
+        //作成したばかりのオブジェクトは所有権ごと渡し、参照カウントの増減を省く
+        object.set_object(i, std::move(child));
     }
 
     return object;
@@ -322,7 +582,7 @@ static void benchmark_multi_thread_thread_safe_rc(benchmark::State& state) {
                 //木構造オブジェクトを作成
                 auto tree = create_tree<ThreadSafeRC>(0, 20);
                 //グローバル変数へ渡す
-                global_variable_with_thread_safe_rc.set_object(0, tree);
+                global_variable_with_thread_safe_rc.set_object(0, std::move(tree));
             }
         };
 
@@ -355,7 +615,7 @@ static void benchmark_multi_thread_dynamic_rc(benchmark::State& state) {
                 //グローバル変数へ渡す
                 //この時mutex化が起こる
                 //詳細については"dynamic_rc.hpp"を参照
-                global_variable_with_dynamic_rc.set_object(0, tree);
+                global_variable_with_dynamic_rc.set_object(0, std::move(tree));
             }
         };
 
@@ -441,6 +701,10 @@ static void benchmark_multithread_with_non_gc(benchmark::State& state) {
  * 循環参照コレクタの速度評価用ベンチマーク (GC時)
  */
 static void benchmark_multithread_with_gc(benchmark::State& state) {
+    //計測スレッドはスレッドの終了を待つのみであるため、経過時間あたりの数とする
+    auto start_stats = get_cycle_collector_stats();
+    auto start_time = chrono::steady_clock::now();
+
     for (auto _ : state) {
         //予め全てのフィールドにオブジェクトをセット
         for (size_t i = 0; i < 10; i++) {
@@ -512,4 +776,774 @@ static void benchmark_multithread_with_gc(benchmark::State& state) {
             global_variable_with_dynamic_rc.set_object(i, nullopt);
         }
     }
-}
\ No newline at end of file
+
+    auto end_stats = get_cycle_collector_stats();
+    auto elapsed_seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+    state.counters["suspects_per_second"] = (double) (end_stats.number_of_suspected - start_stats.number_of_suspected) / elapsed_seconds;
+    state.counters["wasted_traces"] = benchmark::Counter((double) (end_stats.number_of_wasted_traces - start_stats.number_of_wasted_traces), benchmark::Counter::kAvgIterations);
+}
+
+static void benchmark_multithread_with_gc_decrement_trigger(benchmark::State& state) {
+    set_suspect_trigger(suspect_trigger::decrement_to_nonzero);
+    benchmark_multithread_with_gc(state);
+
+    //循環性のある型のオブジェクトを全て回収してから元に戻す
+    gc_collect_all();
+    gc_collect_all();
+    set_suspect_trigger(suspect_trigger::increment_to_shared);
+}
+
+/**
+ * 指定されたアロケータを使用して既存のベンチマーク用関数を実行する
+ */
+static void benchmark_with_allocator(benchmark::State& state, void (*benchmark_func)(benchmark::State&), uint8_t allocator_id) {
+    auto allocate_count = counting_allocator_stats.allocate_count.load(memory_order_relaxed);
+    auto allocated_bytes = counting_allocator_stats.allocated_bytes.load(memory_order_relaxed);
+
+    //ベンチマーク中に作成されるオブジェクトを指定されたアロケータで割り当てる
+    //解放時はオブジェクト毎に記録されたアロケータへ返却されるため、終了後に戻しても問題ない
+    use_heap_allocator(allocator_id);
+    benchmark_func(state);
+    use_heap_allocator(POOL_HEAP_ALLOCATOR_ID);
+
+    if (allocator_id == COUNTING_HEAP_ALLOCATOR_ID) {
+        state.counters["allocations"] = benchmark::Counter(
+            (double) (counting_allocator_stats.allocate_count.load(memory_order_relaxed) - allocate_count),
+            benchmark::Counter::kAvgIterations
+        );
+        state.counters["allocated_bytes"] = benchmark::Counter(
+            (double) (counting_allocator_stats.allocated_bytes.load(memory_order_relaxed) - allocated_bytes),
+            benchmark::Counter::kAvgIterations
+        );
+    }
+}
+
+
+/**
+ * get_object を使用して木構造オブジェクトのノード数を数える
+ */
+size_t count_tree_nodes_with_get_object(DynamicRC& object) {
+    size_t count = 1;
+    for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
+        auto child = object.get_object(i);
+        if (child.has_value()) {
+            count += count_tree_nodes_with_get_object(child.value());
+        }
+    }
+    return count;
+}
+
+/**
+ * with_field を使用して木構造オブジェクトのノード数を数える
+ */
+size_t count_tree_nodes_with_borrow(BorrowedDynamicRC object) {
+    size_t count = 1;
+    for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
+        object.with_field(i, [&count](BorrowedDynamicRC child) {
+            if (child.has_value()) {
+                count += count_tree_nodes_with_borrow(child);
+            }
+        });
+    }
+    return count;
+}
+
+/**
+ * 作成済みの木構造オブジェクトを get_object で読み取りのみ行いながら辿るベンチマーク用関数
+ * state.range(0) が 1 の場合は木構造を予め mutex 化しておく
+ */
+static void benchmark_walk_tree_with_get_object(benchmark::State& state) {
+    auto tree = create_tree<DynamicRC>(0, 16);
+    if (state.range(0) == 1) {
+        tree.to_mutex();
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(count_tree_nodes_with_get_object(tree));
+    }
+}
+
+/**
+ * 作成済みの木構造オブジェクトを with_field で借用しながら辿るベンチマーク用関数
+ * state.range(0) が 1 の場合は木構造を予め mutex 化しておく
+ */
+static void benchmark_walk_tree_with_borrow(benchmark::State& state) {
+    auto tree = create_tree<DynamicRC>(0, 16);
+    if (state.range(0) == 1) {
+        tree.to_mutex();
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(count_tree_nodes_with_borrow(tree.borrow()));
+    }
+}
+
+/**
+ * 手元に保持している木構造オブジェクトとは無関係な小さなオブジェクトを共有した後に、木構造を get_object で辿るベンチマーク用関数
+ * to_mutex で世代を進めることで、共有していない木構造がローカルでなくなる影響を計測する
+ * state.range(0) は伝搬方法(0 : 世代を進める, 1 : 即座に伝搬させる)
+ */
+static void benchmark_walk_tree_after_publish(benchmark::State& state) {
+    auto tree = create_tree<DynamicRC>(0, 16);
+
+    //木構造とは無関係なオブジェクトをグローバル変数へ渡す
+    eager_mutex_propagation = state.range(0) == 1;
+    global_variable_with_dynamic_rc.set_object(0, DynamicRC(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+    eager_mutex_propagation = true;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(count_tree_nodes_with_get_object(tree));
+    }
+
+    global_variable_with_dynamic_rc.set_object(0, nullopt);
+}
+
+/**
+ * 共有した木構造オブジェクトを共有元のスレッドが主に辿り、他のスレッドが時折辿るベンチマーク用関数
+ * state.range(0) が 1 の場合は共有元のスレッドで biased モードを使用する
+ */
+static void benchmark_multi_thread_dominant_owner(benchmark::State& state) {
+    bool use_biased = state.range(0) == 1;
+
+    for (auto _ : state) {
+        atomic_bool is_finished(false);
+
+        auto owner_func = [use_biased](atomic_bool& is_finished) {
+            enable_biased_rc(use_biased);
+
+            //木構造オブジェクトを作成してグローバル変数へ渡す
+            //この時mutex化が起こり、biased モードであればこのスレッドが所有スレッドとなる
+            auto tree = create_tree<DynamicRC>(0, 12);
+            global_variable_with_dynamic_rc.set_object(0, tree);
+
+            //共有後も木構造オブジェクトへのアクセスの大半はこのスレッドで行われる
+            for (size_t i = 0; i < 20; i++) {
+                benchmark::DoNotOptimize(count_tree_nodes_with_get_object(tree));
+            }
+
+            is_finished = true;
+            //他のスレッドから依頼された減算を処理する
+            flush_biased_decrements();
+        };
+
+        auto reader_func = [](atomic_bool& is_finished) {
+            while (!is_finished) {
+                auto tree = global_variable_with_dynamic_rc.get_object(0);
+                if (tree.has_value()) {
+                    benchmark::DoNotOptimize(count_tree_nodes_with_get_object(tree.value()));
+                }
+            }
+        };
+
+        vector<thread> threads;
+        //スレッド起動
+        threads.push_back(thread(owner_func, ref(is_finished)));
+        for (size_t i = 0; i < NUMBER_OF_THREADS - 1; i++) {
+            threads.push_back(thread(reader_func, ref(is_finished)));
+        }
+
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+    }
+}
+
+//DAG の各層のオブジェクト数
+#define DAG_WIDTH 64
+
+/**
+ * 指定された形状とおよそのオブジェクト数のオブジェクトグラフを作成
+ */
+DynamicRC create_graph(size_t shape, size_t log2_number_of_objects) {
+    size_t number_of_objects = (size_t) 1 << log2_number_of_objects;
+
+    if (shape == 0) {
+        //連結リスト
+        DynamicRC head(alloc_heap_object(OBJECT_FIELD_LENGTH));
+        for (size_t i = 1; i < number_of_objects; i++) {
+            DynamicRC node(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            node.set_object(0, std::move(head));
+            head = std::move(node);
+        }
+        return head;
+    }
+
+    if (shape == 1) {
+        //二分木
+        return create_tree<DynamicRC>(0, log2_number_of_objects - 1);
+    }
+
+    //DAG
+    //各オブジェクトは一つ下の層の隣り合う二つのオブジェクトを参照する
+    vector<DynamicRC> layer;
+    for (size_t i = 0; i < DAG_WIDTH; i++) {
+        layer.push_back(DynamicRC(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+    }
+    for (size_t depth = 1; depth < number_of_objects / DAG_WIDTH; depth++) {
+        vector<DynamicRC> upper_layer;
+        for (size_t i = 0; i < DAG_WIDTH; i++) {
+            DynamicRC node(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            node.set_object(0, layer[i]);
+            node.set_object(1, layer[(i + 1) % DAG_WIDTH]);
+            upper_layer.push_back(std::move(node));
+        }
+        layer.swap(upper_layer);
+    }
+
+    //最上位の層の全てのオブジェクトを参照するルート
+    DynamicRC root(alloc_heap_object(DAG_WIDTH));
+    for (size_t i = 0; i < DAG_WIDTH; i++) {
+        root.set_object(i, std::move(layer[i]));
+    }
+    return root;
+}
+
+/**
+ * benchmark_publish_graph の引数の組み合わせを登録する
+ * 連結リストはデストラクタの再帰が深くなりすぎないよう小さなものに限る
+ */
+static void publish_graph_arguments(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t mode = 0; mode <= 2; mode++) {
+        for (int64_t log2_number_of_objects : {10, 14}) {
+            benchmark->Args({0, log2_number_of_objects, mode});
+        }
+        for (int64_t shape = 1; shape <= 2; shape++) {
+            for (int64_t log2_number_of_objects : {10, 14, 20}) {
+                benchmark->Args({shape, log2_number_of_objects, mode});
+            }
+        }
+    }
+}
+
+/**
+ * 作成済みのオブジェクトグラフをグローバル変数へ渡す(共有する)処理のみを計測するベンチマーク用関数
+ * state.range(0) はグラフの形状(0 : 連結リスト, 1 : 二分木, 2 : DAG)
+ * state.range(1) はオブジェクト数の2を底とする対数
+ * state.range(2) は伝搬方法(0 : 世代を進める, 1 : 即座に伝搬させる, 2 : 即座に並列に伝搬させる)
+ */
+static void benchmark_publish_graph(benchmark::State& state) {
+    auto mode = state.range(2);
+    eager_mutex_propagation = mode != 0;
+    if (mode == 2) {
+        set_parallel_propagation(NUMBER_OF_THREADS, 4096);
+    }
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto graph = create_graph(state.range(0), state.range(1));
+        state.ResumeTiming();
+
+        //グローバル変数へ渡す
+        global_variable_with_dynamic_rc.set_object(0, std::move(graph));
+
+        state.PauseTiming();
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+        state.ResumeTiming();
+    }
+
+    eager_mutex_propagation = true;
+    set_parallel_propagation(1, 0);
+}
+
+
+//benchmark_multi_thread_read_global で各スレッドが読む回数
+#define READ_GLOBAL_COUNT 100000
+
+static void benchmark_multi_thread_read_global(benchmark::State& state) {
+    bool with_writer = state.range(0) == 1;
+
+    for (auto _ : state) {
+        global_variable_with_dynamic_rc.set_object(0, DynamicRC(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+        atomic_bool is_finished(false);
+
+        auto reader_func = []() {
+            for (size_t i = 0; i < READ_GLOBAL_COUNT; i++) {
+                benchmark::DoNotOptimize(global_variable_with_dynamic_rc.get_object(0));
+            }
+        };
+
+        auto writer_func = [](atomic_bool& is_finished) {
+            while (!is_finished) {
+                global_variable_with_dynamic_rc.set_object(0, DynamicRC(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+            }
+        };
+
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS - 1; i++) {
+            threads.push_back(thread(reader_func));
+        }
+        thread writer;
+        if (with_writer) {
+            writer = thread(writer_func, ref(is_finished));
+        }
+
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        is_finished = true;
+        if (with_writer) {
+            writer.join();
+        }
+
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+    }
+}
+
+
+//benchmark_suspect_scaling で各スレッドが登録するオブジェクト数
+#define SUSPECT_SCALING_COUNT 20000
+
+static void benchmark_suspect_scaling(benchmark::State& state) {
+    auto number_of_threads = (size_t) state.range(0);
+    auto use_collector_service = state.range(1) == 1;
+
+    for (auto _ : state) {
+        //gc threadを停止するかどうか
+        atomic_bool is_finished(false);
+
+        //実行スレッド側の処理
+        auto mutator_func = []() {
+            for (size_t s = 0; s < SUSPECT_SCALING_COUNT; s++) {
+                DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                object.mark_as_cyclic_type();
+                //参照カウントが1から2になるため、循環参照疑惑のあるオブジェクトとして登録される
+                DynamicRC copy(object);
+                benchmark::DoNotOptimize(copy);
+            }
+        };
+
+        //gc thread 側の処理
+        auto gc_func = [](atomic_bool& is_finished) {
+            while (!is_finished.load(memory_order_relaxed)) {
+                gc_collect();
+            }
+        };
+        thread gc_thread;
+        if (use_collector_service) {
+            start_collector_service();
+        } else {
+            gc_thread = thread(gc_func, ref(is_finished));
+        }
+
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < number_of_threads; i++) {
+            threads.push_back(thread(mutator_func));
+        }
+
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        if (use_collector_service) {
+            stop_collector_service();
+        } else {
+            is_finished.store(true, memory_order_relaxed);
+            gc_thread.join();
+        }
+
+        //残ったオブジェクトを回収
+        state.PauseTiming();
+        gc_collect_all();
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0) * SUSPECT_SCALING_COUNT);
+}
+
+
+static void benchmark_collect_long_cycle(benchmark::State& state) {
+    auto count = (size_t) 1 << state.range(0);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        {
+            DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            object.mark_as_cyclic_type();
+            global_variable_with_dynamic_rc.set_object(0, std::move(object));
+        }
+        {
+            //参照カウントが1から2になるため、先頭のオブジェクトが循環参照疑惑のあるオブジェクトとして登録される
+            auto head = global_variable_with_dynamic_rc.get_object(0).value();
+
+            //先頭から順に繋げていき、最後に先頭へ戻して輪にする
+            auto current = head;
+            for (size_t i = 1; i < count; i++) {
+                DynamicRC next(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                next.mark_as_cyclic_type();
+                current.set_object(0, next);
+                current = std::move(next);
+            }
+            current.set_object(0, head);
+        }
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+        state.ResumeTiming();
+
+        gc_collect();
+    }
+
+    state.SetItemsProcessed(state.iterations() * (int64_t) count);
+}
+
+
+static void benchmark_parallel_collect(benchmark::State& state) {
+    auto number_of_workers = (size_t) state.range(0);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < PARALLEL_COLLECT_CYCLES; i++) {
+            {
+                DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                object.mark_as_cyclic_type();
+                global_variable_with_dynamic_rc.set_object(0, std::move(object));
+            }
+            //参照カウントが1から2になるため、循環参照疑惑のあるオブジェクトとして登録される
+            auto first = global_variable_with_dynamic_rc.get_object(0).value();
+            DynamicRC second(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            second.mark_as_cyclic_type();
+            first.set_object(0, second);
+            second.set_object(0, first);
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+        }
+        state.ResumeTiming();
+
+        gc_collect(number_of_workers);
+    }
+
+    state.SetItemsProcessed(state.iterations() * PARALLEL_COLLECT_CYCLES * 2);
+}
+
+
+/**
+ * グローバル変数の0番目のフィールドにあるオブジェクトを根として、全ての葉が根を参照する二分木を作成する
+ * 作成した全てのオブジェクトを幅優先の順に nodes へ格納する
+ */
+static void build_big_graph(vector<DynamicRC>& nodes) {
+    nodes.reserve(BIG_GRAPH_OBJECTS);
+    nodes.push_back(global_variable_with_dynamic_rc.get_object(0).value());
+
+    //幅優先で子を繋げていき、葉からは根を参照させる
+    for (size_t i = 0; i < BIG_GRAPH_OBJECTS; i++) {
+        for (size_t field_index = 0; field_index < OBJECT_FIELD_LENGTH; field_index++) {
+            auto child_index = i * OBJECT_FIELD_LENGTH + field_index + 1;
+            if (child_index < BIG_GRAPH_OBJECTS) {
+                DynamicRC child(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                child.mark_as_cyclic_type();
+                nodes[i].set_object(field_index, child);
+                nodes.push_back(std::move(child));
+            } else if (field_index == 0) {
+                nodes[i].set_object(field_index, nodes[0]);
+            }
+        }
+    }
+}
+
+
+static void benchmark_collect_big_graph(benchmark::State& state) {
+    auto number_of_workers = (size_t) state.range(0);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        {
+            DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            object.mark_as_cyclic_type();
+            global_variable_with_dynamic_rc.set_object(0, std::move(object));
+        }
+        {
+            //参照カウントが1から2になるため、根が循環参照疑惑のあるオブジェクトとして登録される
+            vector<DynamicRC> nodes;
+            build_big_graph(nodes);
+        }
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+        state.ResumeTiming();
+
+        gc_collect(number_of_workers);
+    }
+
+    state.SetItemsProcessed(state.iterations() * BIG_GRAPH_OBJECTS);
+}
+
+
+static void benchmark_collect_step(benchmark::State& state) {
+    auto max_objects = (size_t) state.range(0);
+    size_t number_of_steps = 0;
+    chrono::steady_clock::duration max_step_time{0};
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < PARALLEL_COLLECT_CYCLES; i++) {
+            {
+                DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                object.mark_as_cyclic_type();
+                global_variable_with_dynamic_rc.set_object(0, std::move(object));
+            }
+            //参照カウントが1から2になるため、循環参照疑惑のあるオブジェクトとして登録される
+            auto first = global_variable_with_dynamic_rc.get_object(0).value();
+            DynamicRC second(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            second.mark_as_cyclic_type();
+            first.set_object(0, second);
+            second.set_object(0, first);
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+        }
+        state.ResumeTiming();
+
+        bool is_finished;
+        do {
+            auto start = chrono::steady_clock::now();
+            is_finished = gc_collect_step(max_objects);
+            max_step_time = max(max_step_time, chrono::steady_clock::now() - start);
+            number_of_steps++;
+        } while (!is_finished);
+    }
+
+    state.SetItemsProcessed(state.iterations() * PARALLEL_COLLECT_CYCLES * 2);
+    state.counters["steps"] = benchmark::Counter((double) number_of_steps, benchmark::Counter::kAvgIterations);
+    state.counters["max_step_us"] = (double) chrono::duration_cast<chrono::microseconds>(max_step_time).count();
+}
+
+
+static void benchmark_mutator_stall(benchmark::State& state) {
+    set_concurrent_detection(state.range(0) == 1);
+
+    {
+        DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+        object.mark_as_cyclic_type();
+        global_variable_with_dynamic_rc.set_object(0, std::move(object));
+    }
+    //根はグローバル変数から参照されたままであるため、回収される度に解放されずに次の回収で再び調べられる
+    //最後の葉のみを残し、そのフィールドを書き換え続ける
+    optional<DynamicRC> leaf;
+    {
+        vector<DynamicRC> nodes;
+        build_big_graph(nodes);
+        leaf = nodes.back();
+    }
+
+    atomic_bool is_finished(false);
+    atomic<int64_t> max_stall_ns(0);
+
+    //実行スレッド側の処理
+    auto mutator_func = [&]() {
+        while (!is_finished.load(memory_order_relaxed)) {
+            auto start = chrono::steady_clock::now();
+            leaf->set_object(1, nullopt);
+            auto stall_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            if (stall_ns > max_stall_ns.load(memory_order_relaxed)) {
+                max_stall_ns.store(stall_ns, memory_order_relaxed);
+            }
+        }
+    };
+    thread mutator(mutator_func);
+
+    for (auto _ : state) {
+        gc_collect_all();
+    }
+
+    is_finished.store(true, memory_order_relaxed);
+    mutator.join();
+
+    state.counters["max_stall_us"] = (double) max_stall_ns.load() / 1000.0;
+    state.SetItemsProcessed(state.iterations() * BIG_GRAPH_OBJECTS);
+
+    //グローバル変数から外して回収する
+    leaf = nullopt;
+    global_variable_with_dynamic_rc.set_object(0, nullopt);
+    set_concurrent_detection(false);
+    gc_collect_all();
+}
+
+
+/**
+ * 二つのオブジェクトが互いに参照する循環参照を作成し、その片方を返す
+ */
+static DynamicRC create_pair_cycle() {
+    DynamicRC first(alloc_heap_object(OBJECT_FIELD_LENGTH));
+    DynamicRC second(alloc_heap_object(OBJECT_FIELD_LENGTH));
+    first.mark_as_cyclic_type();
+    second.mark_as_cyclic_type();
+    first.set_object(0, second);
+    second.set_object(0, first);
+    return first;
+}
+
+
+static void benchmark_collect_with_live_cycles(benchmark::State& state) {
+    vector<DynamicRC> live_cycles;
+    live_cycles.reserve((size_t) state.range(0));
+    for (int64_t i = 0; i < state.range(0); i++) {
+        live_cycles.push_back(create_pair_cycle());
+    }
+    //回収を生き延びさせて古いルートオブジェクトにし、それを調べる間隔が上限に達するまで回収を繰り返す
+    for (size_t i = 0; i < 128; i++) {
+        gc_collect();
+    }
+
+    auto start_stats = get_cycle_collector_stats();
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < GARBAGE_CYCLES_PER_COLLECTION; i++) {
+            create_pair_cycle();
+        }
+        state.ResumeTiming();
+
+        gc_collect();
+    }
+    auto end_stats = get_cycle_collector_stats();
+
+    state.SetItemsProcessed(state.iterations() * GARBAGE_CYCLES_PER_COLLECTION);
+    state.counters["cached_roots"] = benchmark::Counter((double) (end_stats.number_of_cached_roots - start_stats.number_of_cached_roots), benchmark::Counter::kAvgIterations);
+
+    live_cycles.clear();
+    gc_collect_all();
+}
+
+
+static void benchmark_store_into_traced_objects(benchmark::State& state) {
+    auto number_of_threads = (size_t) state.range(0);
+
+    vector<DynamicRC> live_cycles;
+    live_cycles.reserve(TRACED_STORE_CYCLES);
+    for (size_t i = 0; i < TRACED_STORE_CYCLES; i++) {
+        live_cycles.push_back(create_pair_cycle());
+    }
+
+    auto store_func = [&live_cycles, number_of_threads](size_t thread_index) {
+        for (size_t i = thread_index; i < live_cycles.size(); i += number_of_threads) {
+            live_cycles[i].set_object(1, nullopt);
+        }
+    };
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        //全てのルートオブジェクトを辿り直し、循環参照を生存していると判定された部分グラフにする
+        gc_collect_all();
+        state.ResumeTiming();
+
+        vector<thread> threads;
+        for (size_t i = 0; i < number_of_threads; i++) {
+            threads.push_back(thread(store_func, i));
+        }
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * TRACED_STORE_CYCLES);
+
+    live_cycles.clear();
+    gc_collect_all();
+}
+
+
+static void benchmark_collect_random_graph(benchmark::State& state) {
+    auto component_size = (size_t) state.range(0);
+    set_cycle_detection_engine(state.range(1) == 0 ? cycle_detection_engine::trial_deletion : cycle_detection_engine::strongly_connected_components);
+
+    mt19937 random(1);
+    vector<DynamicRC> live_components;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        //前回の反復で生存させた成分を回収してから作り直す
+        live_components.clear();
+        gc_collect_all();
+
+        vector<DynamicRC> objects;
+        objects.reserve(RANDOM_GRAPH_OBJECTS);
+        for (size_t i = 0; i < RANDOM_GRAPH_OBJECTS; i++) {
+            DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            object.mark_as_cyclic_type();
+            objects.push_back(std::move(object));
+        }
+
+        for (size_t begin = 0; begin < RANDOM_GRAPH_OBJECTS; begin += component_size) {
+            for (size_t i = begin; i < begin + component_size; i++) {
+                //成分内を環状に繋ぐ
+                auto next = i + 1 == begin + component_size ? begin : i + 1;
+                objects[i].set_object(0, objects[next]);
+
+                //半分は成分内へ、残りは後に作成した成分へ参照を加える
+                auto end = begin + component_size;
+                if (random() % 2 == 0 || end == RANDOM_GRAPH_OBJECTS) {
+                    objects[i].set_object(1, objects[begin + random() % component_size]);
+                } else {
+                    objects[i].set_object(1, objects[end + random() % (RANDOM_GRAPH_OBJECTS - end)]);
+                }
+            }
+
+            if ((begin / component_size) % 4 == 0) {
+                live_components.push_back(objects[begin]);
+            }
+        }
+        objects.clear();
+        state.ResumeTiming();
+
+        gc_collect();
+    }
+
+    state.SetItemsProcessed(state.iterations() * RANDOM_GRAPH_OBJECTS);
+
+    live_components.clear();
+    gc_collect_all();
+    set_cycle_detection_engine(cycle_detection_engine::trial_deletion);
+}
+
+
+static void benchmark_collect_with_trace_limit(benchmark::State& state) {
+    set_trace_limit((size_t) state.range(0), 0);
+
+    //大きな環状の構造を作成し、外部から参照したまま残す
+    vector<DynamicRC> live_graph;
+    {
+        vector<DynamicRC> objects;
+        objects.reserve(TRACE_LIMIT_GRAPH_OBJECTS);
+        for (size_t i = 0; i < TRACE_LIMIT_GRAPH_OBJECTS; i++) {
+            DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            object.mark_as_cyclic_type();
+            objects.push_back(std::move(object));
+        }
+        for (size_t i = 0; i < TRACE_LIMIT_GRAPH_OBJECTS; i++) {
+            objects[i].set_object(0, objects[(i + 1) % TRACE_LIMIT_GRAPH_OBJECTS]);
+        }
+        live_graph.push_back(objects[0]);
+    }
+    //構造のルートオブジェクトを古いルートオブジェクトにする
+    for (size_t i = 0; i < 128; i++) {
+        gc_collect();
+    }
+
+    //構造を参照するルートオブジェクト
+    vector<DynamicRC> handles;
+
+    auto start_stats = get_cycle_collector_stats();
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < GARBAGE_CYCLES_PER_COLLECTION; i++) {
+            create_pair_cycle();
+        }
+        DynamicRC handle(alloc_heap_object(OBJECT_FIELD_LENGTH));
+        handle.mark_as_cyclic_type();
+        handle.set_object(0, live_graph[0]);
+        //共有してルートオブジェクトとして記録させる
+        handles.push_back(handle);
+        state.ResumeTiming();
+
+        gc_collect();
+    }
+    auto end_stats = get_cycle_collector_stats();
+
+    state.SetItemsProcessed(state.iterations() * GARBAGE_CYCLES_PER_COLLECTION);
+    state.counters["trace_limit_hits"] = benchmark::Counter((double) (end_stats.number_of_trace_limit_hits - start_stats.number_of_trace_limit_hits), benchmark::Counter::kAvgIterations);
+
+    handles.clear();
+    live_graph.clear();
+    gc_collect_all();
+    set_trace_limit(0, 0);
+}
@@ -0,0 +1,203 @@
+#include "epoch_reclamation.hpp"
+#include "heap_object.hpp"
+#include "spin_lock.hpp"
+
+
+atomic<uint64_t> global_epoch{1};
+
+atomic<size_t> number_of_epoch_threads{0};
+
+//全てのスレッドの読み取り状態と、終了したスレッドから引き継げるもの
+SpinLock epoch_records_lock{};
+vector<EpochRecord*> epoch_records{};
+vector<EpochRecord*> free_epoch_records{};
+
+//終了したスレッドが解放しきれなかった退避したオブジェクト
+//プロセスの終了処理の中でグローバル変数のデストラクタから退避される場合があるため、破棄しない
+SpinLock orphan_batches_lock{};
+auto* orphan_batches = new vector<pair<uint64_t, vector<HeapObject*>>>();
+
+//スレッドの終了処理で読み取り状態を手放したかどうか
+thread_local bool is_epoch_record_released = false;
+
+
+/**
+ * まだエポックを付けていない退避したオブジェクトに、現在のエポックを付けて記録する
+ */
+static void seal_pending_objects(EpochRecord* record) {
+    if (record->pending_objects.empty()) {
+        return;
+    }
+    //付けるエポックが、退避したオブジェクトをフィールドから外した後に読んだものとなるようにする
+    atomic_thread_fence(memory_order_seq_cst);
+    auto epoch = global_epoch.load(memory_order_seq_cst);
+
+    vector<HeapObject*> objects;
+    objects.swap(record->pending_objects);
+    record->retired_batches.emplace_back(epoch, std::move(objects));
+}
+
+
+/**
+ * 読み取り中の全てのスレッドが現在のエポックを公開していれば、エポックを一つ進める
+ */
+static void try_advance_epoch() {
+    atomic_thread_fence(memory_order_seq_cst);
+    auto epoch = global_epoch.load(memory_order_seq_cst);
+
+    epoch_records_lock.lock();
+    for (auto* record : epoch_records) {
+        auto active_epoch = record->active_epoch.load(memory_order_acquire);
+        if (active_epoch != 0 && active_epoch != epoch) {
+            epoch_records_lock.unlock();
+            return;
+        }
+    }
+    epoch_records_lock.unlock();
+
+    //他のスレッドが先に進めていた場合は何もしない
+    global_epoch.compare_exchange_strong(epoch, epoch + 1, memory_order_seq_cst);
+}
+
+
+/**
+ * 記録された退避したオブジェクトのうち、解放可能なものを解放する
+ */
+static void free_retired_batches(vector<pair<uint64_t, vector<HeapObject*>>>& batches) {
+    auto epoch = global_epoch.load(memory_order_seq_cst);
+
+    size_t number_of_freed = 0;
+    for (auto& batch : batches) {
+        //エポックの昇順に並んでいるため、解放できないものが見つかれば以降も解放できない
+        if (batch.first + 2 > epoch) {
+            break;
+        }
+        for (auto* object : batch.second) {
+            free_heap_object(object);
+        }
+        number_of_freed++;
+    }
+    batches.erase(batches.begin(), batches.begin() + (ptrdiff_t) number_of_freed);
+}
+
+
+/**
+ * 終了したスレッドが解放しきれなかった退避したオブジェクトのうち、解放可能なものを解放する
+ */
+static void free_orphan_batches() {
+    orphan_batches_lock.lock();
+    if (!orphan_batches->empty()) {
+        free_retired_batches(*orphan_batches);
+    }
+    orphan_batches_lock.unlock();
+}
+
+
+/**
+ * スレッドの終了時に退避したオブジェクトを引き渡し、読み取り状態を他のスレッドが引き継げるようにする
+ */
+struct EpochRecordGuard {
+    EpochRecord* record = nullptr;
+
+    ~EpochRecordGuard() {
+        if (this->record == nullptr) {
+            return;
+        }
+
+        seal_pending_objects(this->record);
+        try_advance_epoch();
+        free_retired_batches(this->record->retired_batches);
+
+        if (!this->record->retired_batches.empty()) {
+            orphan_batches_lock.lock();
+            for (auto& batch : this->record->retired_batches) {
+                orphan_batches->push_back(std::move(batch));
+            }
+            orphan_batches_lock.unlock();
+            this->record->retired_batches.clear();
+        }
+
+        epoch_records_lock.lock();
+        free_epoch_records.push_back(this->record);
+        epoch_records_lock.unlock();
+        number_of_epoch_threads.fetch_sub(1, memory_order_seq_cst);
+
+        current_epoch_record = nullptr;
+        is_epoch_record_released = true;
+    }
+};
+
+thread_local EpochRecordGuard epoch_record_guard;
+
+
+EpochRecord* init_epoch_record() {
+    EpochRecord* record;
+
+    epoch_records_lock.lock();
+    if (!free_epoch_records.empty()) {
+        record = free_epoch_records.back();
+        free_epoch_records.pop_back();
+    } else {
+        record = new EpochRecord();
+        epoch_records.push_back(record);
+    }
+    epoch_records_lock.unlock();
+    //読み始める前に、他のスレッドが retire_or_free_heap_object で読むスレッドの数を増やしておく
+    //(終了処理の中で割り当てられたものは減らさずに残るが、直ちに解放しなくなるだけである)
+    number_of_epoch_threads.fetch_add(1, memory_order_seq_cst);
+
+    //スレッドの終了処理の中で割り当てられた場合は、引き継げるようにはせず残しておく
+    if (!is_epoch_record_released) {
+        epoch_record_guard.record = record;
+    }
+    current_epoch_record = record;
+    return record;
+}
+
+
+void retire_heap_object(HeapObject* object) {
+    auto* record = current_epoch_record;
+    if (record == nullptr) [[unlikely]] {
+        if (is_epoch_record_released) {
+            //スレッドの終了処理の中で退避された場合は、直接引き渡す
+            atomic_thread_fence(memory_order_seq_cst);
+            auto epoch = global_epoch.load(memory_order_seq_cst);
+            orphan_batches_lock.lock();
+            orphan_batches->emplace_back(epoch, vector<HeapObject*>{object});
+            orphan_batches_lock.unlock();
+            return;
+        }
+        record = init_epoch_record();
+    }
+
+    record->pending_objects.push_back(object);
+    if (record->pending_objects.size() < EPOCH_RETIRE_BATCH_SIZE) [[likely]] {
+        return;
+    }
+
+    seal_pending_objects(record);
+    try_advance_epoch();
+    free_retired_batches(record->retired_batches);
+    free_orphan_batches();
+
+    //他のスレッドから biased_count の減算を依頼されていれば、ここでも処理する
+    //(オブジェクトを割り当てずに解放だけを続けるスレッドのため)
+    poll_biased_decrements();
+}
+
+
+void reclaim_retired_objects() {
+    auto* record = current_epoch_record;
+    if (record != nullptr) {
+        seal_pending_objects(record);
+    }
+
+    //記録した時点のエポックから二つ進める
+    try_advance_epoch();
+    try_advance_epoch();
+
+    if (record != nullptr) {
+        free_retired_batches(record->retired_batches);
+    }
+    free_orphan_batches();
+}
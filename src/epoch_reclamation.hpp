@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+
+#include "heap_object.hpp"
+
+using namespace std;
+
+
+/**
+ * エポックベースの遅延解放(epoch-based reclamation)
+ *
+ * ローカルでないオブジェクトのフィールドをロックを取らずに読めるようにするために使用する。
+ * ロックを取らずにフィールドからロードしたオブジェクトは、参照カウントを増やす前に他のスレッドによって
+ * フィールドから外されて解放されている可能性があるため、解放された領域の再利用をそのようなスレッドが居なくなるまで遅らせる。
+ *
+ *  1. フィールドをロックを取らずに読むスレッドは、読み始める前に現在のグローバルなエポックを公開し(enter_epoch)、
+ *     読み終えたら公開を取り下げる(exit_epoch)
+ *
+ *  2. ローカルでないオブジェクトを解放するスレッドは、直ちに解放する代わりに retire_heap_object で退避する
+ *     退避されたオブジェクトは一定数毎にまとめて、その時点のエポックを付けて記録される
+ *
+ *  3. エポックは、読み取り中の全てのスレッドが現在のエポックを公開している場合のみ一つ進められる
+ *     エポック e で記録されたオブジェクトは、エポックが e + 2 以上になった時点で実際に解放する
+ *
+ * 記録される時点で既にオブジェクトはどのフィールドからも外されているため、それ以降に読み始めたスレッドがロードすることはない。
+ * それ以前から読み取り中のスレッドは e 以下のエポックを公開しているため、エポックは e + 1 より先に進まない。
+ * ローカルなオブジェクトは他のスレッドから読まれることがないため、従来通り直ちに解放する。
+ * 同様に、読み取り状態を持つスレッドが解放するスレッド以外に存在しない場合も直ちに解放できる(retire_or_free_heap_object を参照)。
+ */
+
+//退避したオブジェクトをまとめてエポックを付ける単位
+#define EPOCH_RETIRE_BATCH_SIZE 256
+
+
+/**
+ * スレッド毎の読み取り状態と退避したオブジェクト
+ * 他のスレッドが読み取り状態を参照するため、一度作成したら破棄せず、終了したスレッドのものは再利用する
+ */
+struct EpochRecord {
+    //読み取り中であれば公開したエポック、そうでなければ0
+    atomic<uint64_t> active_epoch{0};
+    //enter_epoch の入れ子の深さ
+    size_t nesting = 0;
+    //まだエポックを付けていない退避したオブジェクト
+    vector<HeapObject*> pending_objects;
+    //エポックを付けて記録した退避したオブジェクト(エポックの昇順)
+    vector<pair<uint64_t, vector<HeapObject*>>> retired_batches;
+};
+
+
+//グローバルなエポック(1から始まる)
+extern atomic<uint64_t> global_epoch;
+
+//読み取り状態を割り当てられている(フィールドをロックを取らずに読んだことがあり、まだ終了していない)スレッドの数
+extern atomic<size_t> number_of_epoch_threads;
+
+//現在のスレッドの読み取り状態
+inline thread_local EpochRecord* current_epoch_record = nullptr;
+
+/**
+ * 現在のスレッドに読み取り状態を割り当てる(終了したスレッドのものがあればそれを引き継ぐ)
+ */
+EpochRecord* init_epoch_record();
+
+
+/**
+ * フィールドをロックを取らずに読み始める
+ * 入れ子にして呼び出すことができる
+ */
+inline void enter_epoch() {
+    auto* record = current_epoch_record;
+    if (record == nullptr) [[unlikely]] {
+        record = init_epoch_record();
+    }
+    if (record->nesting++ == 0) {
+        record->active_epoch.store(global_epoch.load(memory_order_relaxed), memory_order_relaxed);
+        //公開したエポックが、これ以降のフィールドのロードよりも先に他のスレッドから見えるようにする
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+/**
+ * フィールドの読み取りを終える
+ */
+inline void exit_epoch() {
+    auto* record = current_epoch_record;
+    if (--record->nesting == 0) {
+        record->active_epoch.store(0, memory_order_release);
+    }
+}
+
+
+/**
+ * スコープの間だけフィールドをロックを取らずに読むためのガード
+ */
+class EpochGuard {
+
+public:
+    inline EpochGuard() {
+        enter_epoch();
+    }
+
+    inline ~EpochGuard() {
+        exit_epoch();
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+};
+
+
+/**
+ * ローカルでないオブジェクトの解放を、読み取り中のスレッドが居なくなるまで遅らせる
+ */
+void retire_heap_object(HeapObject* object);
+
+/**
+ * 現在のスレッド以外にフィールドをロックを取らずに読んでいるスレッドが居る可能性が無ければ直ちに解放し、そうでなければ退避する
+ *
+ * 読み取り中のスレッドは読み始める前に読み取り状態を割り当てられているため、オブジェクトをフィールドから外した後に
+ * 読み取り状態を持つスレッドが現在のスレッドのみであれば、外される前にロードしたスレッドは存在しない。
+ * 単一のスレッドのみで使用している間は、退避する処理を省いて従来通り直ちに解放する。
+ * オブジェクトを最後のフィールドから外す操作は seq_cst で行われている必要がある。
+ * それにより、外される前にロードしたスレッドが読む前に増やしたスレッドの数が、ここでの seq_cst のロードから見える
+ * (読む側は増やした後に enter_epoch の seq_cst のフェンスを挟んでロードする)
+ */
+inline void retire_or_free_heap_object(HeapObject* object) {
+    auto number_of_threads = number_of_epoch_threads.load(memory_order_seq_cst);
+    if (number_of_threads == 0 || (number_of_threads == 1 && current_epoch_record != nullptr)) {
+        free_heap_object(object);
+    } else {
+        retire_heap_object(object);
+    }
+}
+
+/**
+ * 読み取り中のスレッドが居なければ、退避された全てのオブジェクト(終了したスレッドのものを含む)を解放する
+ * 読み取り中のスレッドが居る場合は、解放可能なものだけを解放する
+ */
+void reclaim_retired_objects();
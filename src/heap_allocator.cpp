@@ -0,0 +1,85 @@
+#include "heap_allocator.hpp"
+#include "object_pool.hpp"
+#include "spin_lock.hpp"
+
+#include <iostream>
+
+
+/**
+ * プールアロケータ
+ * 詳細は"object_pool.hpp"を参照
+ */
+const HeapAllocator pool_heap_allocator {
+    "pool",
+    [](size_t field_length, size_t allocate_size) { return pool_allocate(field_length, allocate_size); },
+    [](void* ptr, size_t field_length) { pool_free(ptr, field_length); }
+};
+
+/**
+ * malloc/free をそのまま使用するアロケータ
+ */
+const HeapAllocator malloc_heap_allocator {
+    "malloc",
+    [](size_t field_length, size_t allocate_size) { return malloc(allocate_size); },
+    [](void* ptr, size_t field_length) { free(ptr); }
+};
+
+CountingAllocatorStats counting_allocator_stats{};
+
+/**
+ * 割り当てと解放の回数を記録するアロケータ
+ * 領域の管理自体は malloc/free で行う
+ */
+const HeapAllocator counting_heap_allocator {
+    "counting",
+    [](size_t field_length, size_t allocate_size) {
+        counting_allocator_stats.allocate_count.fetch_add(1, memory_order_relaxed);
+        counting_allocator_stats.allocated_bytes.fetch_add(allocate_size, memory_order_relaxed);
+        return malloc(allocate_size);
+    },
+    [](void* ptr, size_t field_length) {
+        counting_allocator_stats.release_count.fetch_add(1, memory_order_relaxed);
+        free(ptr);
+    }
+};
+
+
+const HeapAllocator* heap_allocators[MAX_HEAP_ALLOCATORS] = {
+    &pool_heap_allocator,
+    &malloc_heap_allocator,
+    &counting_heap_allocator
+};
+
+uint8_t current_heap_allocator_id = POOL_HEAP_ALLOCATOR_ID;
+
+SpinLock heap_allocator_lock{};
+
+
+/**
+ * 登録されていないアロケータの番号が指定された場合にプロセスを終了させる
+ */
+void fail_unregistered_heap_allocator(size_t allocator_id) {
+    cerr << "use_heap_allocator: allocator_id " << allocator_id << " is not a registered allocator" << endl;
+    abort();
+}
+
+
+/**
+ * アロケータを登録し、その番号を返す
+ * 登録できない場合は -1 を返す
+ */
+int register_heap_allocator(const HeapAllocator* allocator) {
+    int allocator_id = -1;
+
+    heap_allocator_lock.lock();
+    for (int i = 0; i < MAX_HEAP_ALLOCATORS; i++) {
+        if (heap_allocators[i] == nullptr) {
+            heap_allocators[i] = allocator;
+            allocator_id = i;
+            break;
+        }
+    }
+    heap_allocator_lock.unlock();
+
+    return allocator_id;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+using namespace std;
+
+
+//登録可能なアロケータの最大数
+#define MAX_HEAP_ALLOCATORS 8
+
+//組み込みのアロケータの番号
+//番号 0 のプールアロケータは既定のアロケータであり、割り当てと解放の処理がインライン展開される
+#define POOL_HEAP_ALLOCATOR_ID 0
+#define MALLOC_HEAP_ALLOCATOR_ID 1
+#define COUNTING_HEAP_ALLOCATOR_ID 2
+
+
+/**
+ * HeapObject の割り当てと解放を行うアロケータ
+ *
+ * アロケータは番号を付けて登録され、オブジェクトのヘッダには割り当てたアロケータの番号が記録される。
+ * 解放時はその番号のアロケータへ返却されるため、途中で使用するアロケータを切り替えても安全に解放できる。
+ */
+struct HeapAllocator {
+    //アロケータの名前
+    const char* name;
+    //フィールドの長さと確保するサイズを受け取り領域を割り当てる
+    void* (*allocate)(size_t field_length, size_t allocate_size);
+    //割り当てた領域を解放する
+    void (*release)(void* ptr, size_t field_length);
+};
+
+
+/**
+ * 割り当て回数と解放回数を記録するアロケータの統計情報
+ */
+struct CountingAllocatorStats {
+    atomic_size_t allocate_count;
+    atomic_size_t release_count;
+    atomic_size_t allocated_bytes;
+};
+
+
+extern const HeapAllocator pool_heap_allocator;
+extern const HeapAllocator malloc_heap_allocator;
+extern const HeapAllocator counting_heap_allocator;
+extern CountingAllocatorStats counting_allocator_stats;
+
+//登録されたアロケータの一覧
+extern const HeapAllocator* heap_allocators[MAX_HEAP_ALLOCATORS];
+//新しく作成するオブジェクトの割り当てに使用するアロケータの番号
+extern uint8_t current_heap_allocator_id;
+
+
+/**
+ * アロケータを登録し、その番号を返す
+ * 登録できない場合は -1 を返す
+ */
+int register_heap_allocator(const HeapAllocator* allocator);
+
+
+/**
+ * 登録されていないアロケータの番号が指定された場合にプロセスを終了させる
+ */
+[[noreturn]] void fail_unregistered_heap_allocator(size_t allocator_id);
+
+
+/**
+ * 新しく作成するオブジェクトの割り当てに使用するアロケータを切り替える
+ * 複数のスレッドを起動する前に呼び出すこと
+ * allocator_id は登録されたアロケータの番号でなければならない
+ */
+inline void use_heap_allocator(uint8_t allocator_id) {
+    //範囲外や未登録の番号は、次の alloc_heap_object で不正なアロケータを呼び出してしまうため受け付けない
+    if (allocator_id >= MAX_HEAP_ALLOCATORS || heap_allocators[allocator_id] == nullptr) [[unlikely]] {
+        fail_unregistered_heap_allocator(allocator_id);
+    }
+    current_heap_allocator_id = allocator_id;
+}
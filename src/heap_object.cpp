@@ -0,0 +1,452 @@
+#include "heap_object.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+SpinLock overflow_ref_count_lock{};
+unordered_map<HeapObject*, size_t> overflow_ref_counts{};
+
+//propagate_mutex を並列化するスレッドの数と、並列化を始める訪問済みオブジェクトの数
+size_t parallel_propagation_workers = 1;
+size_t parallel_propagation_threshold = SIZE_MAX;
+
+//並列化する際に、各スレッドへ分配する前に作業リストをこの数(スレッド毎)まで幅優先で広げる
+#define PARALLEL_PROPAGATION_FRONTIER_PER_WORKER 64
+
+
+/**
+ * 現在のスレッドのローカルな世代番号を割り当てる
+ */
+uint64_t init_local_stamp() {
+    current_local_stamp = LOCAL_STAMP_FLAG | ((uint64_t) get_biased_thread_id() << 32) | 1;
+    return current_local_stamp;
+}
+
+
+/**
+ * フィールドの長さが HEAP_OBJECT_MAX_FIELD_LENGTH を超える場合にプロセスを終了させる
+ */
+void fail_field_length_too_large(size_t field_length) {
+    cerr << "alloc_heap_object: field_length " << field_length
+         << " exceeds HEAP_OBJECT_MAX_FIELD_LENGTH (" << HEAP_OBJECT_MAX_FIELD_LENGTH << ")" << endl;
+    abort();
+}
+
+
+/**
+ * 退避された値を含めた参照カウントを取得
+ */
+size_t HeapObject::load_ref_count() {
+    auto count_word = this->atomic_ref_count()->load(memory_order_acquire);
+    size_t ref_count = count_of(count_word);
+
+    //biased モードであれば所有スレッドの biased_count を加える
+    if (count_word & RC_BIASED_BIT) {
+        ref_count += this->load_biased_count();
+    }
+
+    if (this->header_info.load(memory_order_relaxed) & HEADER_OVERFLOW_COUNT_BIT) {
+        overflow_ref_count_lock.lock();
+        auto it = overflow_ref_counts.find(this);
+        if (it != overflow_ref_counts.end()) {
+            ref_count += it->second;
+        }
+        overflow_ref_count_lock.unlock();
+    }
+
+    return ref_count;
+}
+
+
+/**
+ * 参照カウントの一部を overflow_ref_counts へ退避させる
+ */
+void HeapObject::spill_ref_count(bool is_atomic) {
+    overflow_ref_count_lock.lock();
+
+    overflow_ref_counts[this] += RC_OVERFLOW_AMOUNT;
+    this->header_info.fetch_or(HEADER_OVERFLOW_COUNT_BIT, memory_order_relaxed);
+
+    if (is_atomic) {
+        this->atomic_ref_count()->fetch_sub(RC_OVERFLOW_AMOUNT << RC_COUNT_SHIFT, memory_order_relaxed);
+    } else {
+        this->reference_count -= RC_OVERFLOW_AMOUNT << RC_COUNT_SHIFT;
+    }
+
+    overflow_ref_count_lock.unlock();
+}
+
+
+/**
+ * overflow_ref_counts へ退避させた参照カウントを戻す
+ * 戻すことができた場合、若しくは他のスレッドが既に参照カウントを増やしていた場合は true を返す
+ */
+bool HeapObject::refill_ref_count(bool is_atomic) {
+    overflow_ref_count_lock.lock();
+
+    auto it = overflow_ref_counts.find(this);
+    if (it != overflow_ref_counts.end()) {
+        //退避された値が残っている限りオブジェクトは生存している
+        //並行して減らされたことで参照カウントが一時的に下回っていても、ここで足し戻すことで正しい値になる
+        it->second -= RC_OVERFLOW_AMOUNT;
+        if (it->second == 0) {
+            overflow_ref_counts.erase(it);
+        }
+
+        if (is_atomic) {
+            this->atomic_ref_count()->fetch_add(RC_OVERFLOW_AMOUNT << RC_COUNT_SHIFT, memory_order_relaxed);
+        } else {
+            this->reference_count += RC_OVERFLOW_AMOUNT << RC_COUNT_SHIFT;
+        }
+
+        overflow_ref_count_lock.unlock();
+        return true;
+    }
+
+    //退避された値が無い場合、現在の参照カウントが0であればオブジェクトは解放可能である
+    auto ref_count = count_of(this->atomic_ref_count()->load(memory_order_relaxed));
+    overflow_ref_count_lock.unlock();
+
+    return ref_count != 0;
+}
+
+
+/**
+ * biased_count の一部を overflow_ref_counts へ退避させる
+ */
+void HeapObject::spill_biased_count() {
+    overflow_ref_count_lock.lock();
+
+    overflow_ref_counts[this] += RC_OVERFLOW_AMOUNT;
+    this->header_info.fetch_or(HEADER_OVERFLOW_COUNT_BIT, memory_order_relaxed);
+    this->store_biased_count(this->load_biased_count() - RC_OVERFLOW_AMOUNT);
+
+    overflow_ref_count_lock.unlock();
+}
+
+
+/**
+ * 所有スレッドの biased_count が0になった際に biased モードを解除し、参照カウントが0になったかどうかを返す
+ */
+bool HeapObject::merge_biased_count() {
+    //他のスレッドによる共有カウントの変更と競合するため CAS で RC_BIASED_BIT を下ろす
+    auto count_word = this->load_count_word();
+    while (!this->atomic_ref_count()->compare_exchange_weak(count_word, count_word & ~RC_BIASED_BIT, memory_order_acq_rel, memory_order_relaxed)) {}
+
+    if (count_of(count_word) != 0) {
+        return false;
+    }
+
+    if (!(this->header_info.load(memory_order_relaxed) & HEADER_OVERFLOW_COUNT_BIT)) {
+        return true;
+    }
+    return !this->refill_ref_count(true);
+}
+
+
+/**
+ * 所有スレッド以外から biased モードのオブジェクトの参照カウントを一つ減らし、0になったかどうかを返す
+ */
+bool HeapObject::decrement_ref_count_biased_slow() {
+    auto count_word = this->load_count_word();
+    while (true) {
+        if (!(count_word & RC_BIASED_BIT)) {
+            //既に biased モードが解除されている
+            return this->decrement_ref_count_atomic();
+        }
+
+        if (count_of(count_word) != 0) {
+            //共有カウントから減らす
+            //biased モードである間は所有スレッドの biased_count が残っているため0にはならない
+            if (this->atomic_ref_count()->compare_exchange_weak(count_word, count_word - RC_COUNT_ONE, memory_order_release, memory_order_relaxed)) {
+                return false;
+            }
+            continue;
+        }
+
+        //共有カウントが0である場合は所有スレッドへ減算を依頼する
+        if (defer_biased_decrement(this)) {
+            return false;
+        }
+
+        //所有スレッドが既に終了している場合は、biased_count を共有カウントへマージしてから減らす
+        //終了した所有スレッドの biased_count は defer_biased_decrement 内のロックにより取得済みである
+        auto merged_count_word = (count_word & ~RC_BIASED_BIT) + (this->load_biased_count() << RC_COUNT_SHIFT);
+        if (this->atomic_ref_count()->compare_exchange_weak(count_word, merged_count_word, memory_order_acq_rel, memory_order_relaxed)) {
+            return this->decrement_ref_count_atomic();
+        }
+    }
+}
+
+
+/**
+ * ローカルでなくなったが共有されたことが記録されていないオブジェクトを、
+ * 現在のスレッドが割り当てたものであれば biased モードへ切り替え、参照カウントのワードを返す
+ */
+uint32_t HeapObject::try_set_biased_lazily(uint32_t count_word) {
+    //RC_MUTEX_BIT が立つまで local_stamp は割り当て時の値のままである
+    auto local_stamp = ((atomic<uint64_t>*) &this->local_stamp)->load(memory_order_relaxed);
+    //上位32ビットが一致すれば、このオブジェクトを割り当てたスレッドである
+    if ((local_stamp >> 32) != (current_local_stamp >> 32) || this->is_cyclic_type()) {
+        return count_word;
+    }
+
+    //他のスレッドは RC_BIASED_BIT を見た時点で biased_owner_id を読むため、所有者番号とそれまでの参照カウントを先に書き込み、
+    //RC_BIASED_BIT を立てる CAS の release により公開する(読む側は load_shared_count_word の acquire で対応する)
+    //書き込んだ値は LOCAL_STAMP_FLAG を持たないため、切り替わる前に local_stamp として読まれてもどのスレッドのローカルにもならない
+    //他のスレッドが既に atomic-read-modify-write で操作している可能性があるため CAS で切り替え、失敗した場合は読み直した参照カウントで書き直す
+    while (!(count_word & RC_MUTEX_BIT)) {
+        auto biased_word = ((uint64_t) current_biased_thread_id << 32) | count_of(count_word);
+        ((atomic<uint64_t>*) &this->local_stamp)->store(biased_word, memory_order_relaxed);
+
+        //それまでの参照カウントを全て biased_count へ移す
+        auto biased_count_word = (count_word & ~(~0u << RC_COUNT_SHIFT)) | RC_MUTEX_BIT | RC_BIASED_BIT;
+        if (this->atomic_ref_count()->compare_exchange_weak(count_word, biased_count_word, memory_order_release, memory_order_relaxed)) {
+            return biased_count_word;
+        }
+    }
+    return count_word;
+}
+
+
+/**
+ * 即座に伝搬させる際に、訪れたオブジェクトの数が threshold に達した場合は残りを number_of_workers 個のスレッドで並列に伝搬させる
+ * number_of_workers が 1 以下であれば並列化しない
+ */
+void set_parallel_propagation(size_t number_of_workers, size_t threshold) {
+    parallel_propagation_workers = number_of_workers;
+    parallel_propagation_threshold = number_of_workers > 1 ? threshold : SIZE_MAX;
+}
+
+
+/**
+ * propagate_mutex で伝搬させるスレッドの情報
+ * 並列化した場合も、各スレッドは伝搬を始めたスレッドのものとして記録する
+ */
+struct PropagationContext {
+    //伝搬を始めたスレッドの世代番号(この値の local_stamp を持つオブジェクトのみが対象となる)
+    uint64_t local_stamp;
+    //biased モードへ切り替える場合の所有者番号(0 であれば切り替えない)
+    uint32_t biased_owner_id;
+};
+
+
+/**
+ * オブジェクトが伝搬の対象であれば共有されたものとして記録し、true を返す
+ * is_concurrent が true の場合は、他のスレッドと同じオブジェクトを重複して記録しないよう CAS で確保する
+ */
+static inline bool claim_for_propagation(HeapObject* object, const PropagationContext& context, bool is_concurrent) {
+    if (is_concurrent) {
+        auto expected = context.local_stamp;
+        if (!((atomic<uint64_t>*) &object->local_stamp)->compare_exchange_strong(expected, LOCAL_STAMP_SHARED, memory_order_relaxed)) {
+            return false;
+        }
+    } else {
+        if (object->local_stamp != context.local_stamp) {
+            return false;
+        }
+        object->local_stamp = LOCAL_STAMP_SHARED;
+    }
+
+    //確保したオブジェクトは伝搬が終わるまで他のスレッドから操作されない
+    if (context.biased_owner_id != 0 && !object->is_cyclic_type()) {
+        object->set_biased(context.biased_owner_id);
+    } else {
+        object->set_mutex(true);
+    }
+    return true;
+}
+
+
+/**
+ * 並列に伝搬させる際に propagate_mutex を呼び出したスレッドを手伝うスレッドの待ち合わせ
+ * 伝搬の度にスレッドを作成しないよう、手伝うスレッドは初めて必要になった時に起動し、以降の伝搬で再利用する
+ */
+struct PropagationPool {
+    //一度に一つの伝搬のみが手伝うスレッドを使用する
+    mutex use_mutex;
+    mutex pool_mutex;
+    condition_variable start_condition;
+    condition_variable finish_condition;
+    //開始した伝搬の通し番号
+    uint64_t generation = 0;
+    //伝搬に参加するスレッド数(propagate_mutex を呼び出したスレッドを含む)
+    size_t number_of_workers = 0;
+    //まだ作業を終えていない手伝うスレッドの数
+    size_t number_of_running = 0;
+    //起動済みの手伝うスレッドの数(use_mutex の下でのみ操作する)
+    size_t number_of_helpers = 0;
+    //伝搬を始めたスレッドの情報と、スレッド毎の作業リスト
+    const PropagationContext* context = nullptr;
+    vector<vector<HeapObject*>>* stacks = nullptr;
+};
+
+//手伝うスレッドはプロセスの終了時にも待機したままとなるため、破棄しない
+auto* propagation_pool = new PropagationPool();
+
+
+/**
+ * 作業リストのオブジェクトのフィールドを辿って伝搬させる
+ * 訪れたオブジェクトの数が limit に達した場合は、作業リストを残したまま戻る
+ */
+static void propagate_from_stack(vector<HeapObject*>& stack, const PropagationContext& context, bool is_concurrent, size_t& visited, size_t limit) {
+    while (!stack.empty() && visited < limit) {
+        auto* object = stack.back();
+        stack.pop_back();
+        visited++;
+
+        auto field_length = object->get_field_length();
+        auto** fields = (HeapObject**) (object + 1);
+
+        //各フィールドのオブジェクトのヘッダを先に読み込ませておき、キャッシュミスの待ち時間を重ねる
+        for (size_t i = 0; i < field_length; i++) {
+            if (fields[i] != nullptr) {
+                __builtin_prefetch(fields[i], 1);
+            }
+        }
+
+        for (size_t i = 0; i < field_length; i++) {
+            auto* field_object = fields[i];
+            if (field_object != nullptr && claim_for_propagation(field_object, context, is_concurrent)) {
+                stack.push_back(field_object);
+            }
+        }
+    }
+}
+
+
+/**
+ * propagate_mutex を呼び出したスレッドを手伝うスレッドの処理
+ * worker_id 番目の作業リストを担当する
+ */
+static void run_propagation_helper(size_t worker_id, uint64_t generation) {
+    auto* pool = propagation_pool;
+    while (true) {
+        unique_lock<mutex> pool_lock(pool->pool_mutex);
+        pool->start_condition.wait(pool_lock, [&]() { return pool->generation != generation; });
+        generation = pool->generation;
+        if (worker_id >= pool->number_of_workers) {
+            //今回の伝搬には参加しない
+            continue;
+        }
+        auto* context = pool->context;
+        auto& worker_stack = (*pool->stacks)[worker_id];
+        pool_lock.unlock();
+
+        size_t visited = 0;
+        propagate_from_stack(worker_stack, *context, true, visited, SIZE_MAX);
+
+        pool_lock.lock();
+        if (--pool->number_of_running == 0) {
+            pool->finish_condition.notify_one();
+        }
+    }
+}
+
+
+/**
+ * 足りない分の手伝うスレッドを起動する(use_mutex の下で呼び出す)
+ */
+static void prepare_propagation_helpers(size_t number_of_workers) {
+    auto* pool = propagation_pool;
+    while (pool->number_of_helpers + 1 < number_of_workers) {
+        auto worker_id = ++pool->number_of_helpers;
+
+        pool->pool_mutex.lock();
+        auto generation = pool->generation;
+        pool->pool_mutex.unlock();
+        thread(run_propagation_helper, worker_id, generation).detach();
+    }
+}
+
+
+/**
+ * 残りの作業リストを複数のスレッドで並列に伝搬させる
+ * 手伝うスレッドを他の伝搬が使用している場合は、現在のスレッドのみで伝搬させる
+ */
+static void propagate_parallel(vector<HeapObject*>& stack, const PropagationContext& context) {
+    auto number_of_workers = parallel_propagation_workers;
+
+    //深さ優先の作業リストは偏っているため、幅優先で広げてから分配する
+    vector<HeapObject*> frontier;
+    frontier.swap(stack);
+    while (!frontier.empty() && frontier.size() < number_of_workers * PARALLEL_PROPAGATION_FRONTIER_PER_WORKER) {
+        vector<HeapObject*> next_frontier;
+        for (auto* object : frontier) {
+            auto field_length = object->get_field_length();
+            auto** fields = (HeapObject**) (object + 1);
+            for (size_t i = 0; i < field_length; i++) {
+                auto* field_object = fields[i];
+                if (field_object != nullptr && claim_for_propagation(field_object, context, false)) {
+                    next_frontier.push_back(field_object);
+                }
+            }
+        }
+        frontier.swap(next_frontier);
+    }
+
+    if (frontier.empty()) {
+        return;
+    }
+
+    auto* pool = propagation_pool;
+    if (!pool->use_mutex.try_lock()) {
+        //他のスレッドの伝搬が手伝うスレッドを使用している場合は、待たずに現在のスレッドのみで伝搬させる
+        size_t visited = 0;
+        propagate_from_stack(frontier, context, false, visited, SIZE_MAX);
+        return;
+    }
+    prepare_propagation_helpers(number_of_workers);
+
+    //各スレッドへ順番に分配する
+    vector<vector<HeapObject*>> stacks(number_of_workers);
+    for (size_t i = 0; i < frontier.size(); i++) {
+        stacks[i % number_of_workers].push_back(frontier[i]);
+    }
+
+    //手伝うスレッドを起こす
+    pool->pool_mutex.lock();
+    pool->generation++;
+    pool->number_of_workers = number_of_workers;
+    pool->number_of_running = number_of_workers - 1;
+    pool->context = &context;
+    pool->stacks = &stacks;
+    pool->pool_mutex.unlock();
+    pool->start_condition.notify_all();
+
+    //現在のスレッドも一つ分を担当する
+    size_t visited = 0;
+    propagate_from_stack(stacks[0], context, true, visited, SIZE_MAX);
+
+    //pool_mutex により各スレッドでの記録が現在のスレッドから見えるようになる
+    {
+        unique_lock<mutex> pool_lock(pool->pool_mutex);
+        pool->finish_condition.wait(pool_lock, [&]() { return pool->number_of_running == 0; });
+        pool->context = nullptr;
+        pool->stacks = nullptr;
+    }
+    pool->use_mutex.unlock();
+}
+
+
+/**
+ * root 以下の現在のスレッドのローカルなオブジェクト(フィールドに間接的に連なるものを含む)を全て共有されたものとして記録する
+ * 再帰呼び出しを使用せず、明示的な作業リストを使用して辿る
+ */
+void propagate_mutex(HeapObject* root) {
+    PropagationContext context{current_local_stamp, biased_rc_enabled ? get_biased_thread_id() : 0};
+    if (!claim_for_propagation(root, context, false)) {
+        return;
+    }
+
+    //ローカルでないオブジェクトのフィールドに連なるオブジェクトは全てローカルでないため、そこで辿るのを止めてよい
+    vector<HeapObject*> stack{root};
+    size_t visited = 0;
+    propagate_from_stack(stack, context, false, visited, parallel_propagation_threshold);
+
+    if (!stack.empty()) {
+        propagate_parallel(stack, context);
+    }
+}
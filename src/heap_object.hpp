@@ -5,11 +5,18 @@
 #define RC_VALIDATION false
 
 #include <cstddef>
+#include <cstdlib>
 #include <atomic>
 #include <optional>
 #include <iostream>
 #include <unordered_set>
 #include <vector>
+#include <unordered_map>
+
+#include "object_pool.hpp"
+#include "heap_allocator.hpp"
+#include "spin_lock.hpp"
+#include "biased_rc.hpp"
 
 using namespace std;
 
@@ -19,73 +26,746 @@ using namespace std;
 #endif
 
 
+class HeapObject;
+
+//32ビットに収まらなかった参照カウントの退避先
+extern SpinLock overflow_ref_count_lock;
+extern unordered_map<HeapObject*, size_t> overflow_ref_counts;
+
+
+//参照カウントのワード(reference_count)の各ビットの割り当て
+//最下位ビットを is_mutex、次のビットを biased モードかどうかとし、残りの30ビットを参照カウントとする
+//参照カウントを上位に置くことで、カウントの増減がどのように桁あふれしても下位のビットは変化しない
+#define RC_MUTEX_BIT 1u
+#define RC_BIASED_BIT 2u
+#define RC_COUNT_SHIFT 2
+#define RC_COUNT_ONE (1u << RC_COUNT_SHIFT)
+
+//ローカルな世代番号(local_stamp)の最上位ビット
+//biased モードにおいて同じ領域に格納される所有スレッドの番号(31ビット以下)と区別するために常に立てておく
+#define LOCAL_STAMP_FLAG (1ull << 63)
+
+//どのスレッドのローカルでもないオブジェクトの local_stamp
+//LOCAL_STAMP_FLAG を持たず 0 でもないため、どのスレッドの世代番号とも一致しない
+#define LOCAL_STAMP_SHARED 1ull
+
+//循環参照疑惑のあるオブジェクトのスタックの終端
+//同じ領域を共有する local_stamp として読まれても、どのスレッドのローカルにもならないよう LOCAL_STAMP_SHARED と同じ値とする
+#define SUSPECT_LIST_END ((HeapObject*) LOCAL_STAMP_SHARED)
+
+//現在のスレッドのローカルな世代番号
+//上位32ビットが LOCAL_STAMP_FLAG と所有者番号("biased_rc.hpp"を参照)、下位32ビットがスレッド内の世代となる
+//0 は未割り当てであり、どのオブジェクトの local_stamp とも一致しない
+inline thread_local uint64_t current_local_stamp = 0;
+
+/**
+ * 現在のスレッドのローカルな世代番号を割り当てる
+ */
+uint64_t init_local_stamp();
+
+/**
+ * 現在のスレッドの世代を一つ進め、それまでに割り当てた全てのオブジェクトをローカルでなくする
+ * 世代を使い切っている場合は進めずに false を返す
+ */
+inline bool advance_local_stamp() {
+    if ((uint32_t) current_local_stamp == UINT32_MAX) [[unlikely]] {
+        return false;
+    }
+    current_local_stamp++;
+    return true;
+}
+
+//true の場合、to_mutex で世代を進めずにフィールドに連なるオブジェクトへ即座に伝搬させる(既定は true)
+//false にすると to_mutex は定数時間となるが、世代を進めるためにそのスレッドがそれまでに割り当てた全てのオブジェクトがローカルでなくなる
+//読み込んだオブジェクト毎に遅延して共有を記録する方式ではないため、大きな部分グラフを共有するスレッドのみが選択して使用する
+inline thread_local bool eager_mutex_propagation = true;
+
+/**
+ * 即座に伝搬させる際に、訪れたオブジェクトの数が threshold に達した場合は残りを number_of_workers 個のスレッドで並列に伝搬させる
+ * number_of_workers が 1 以下であれば並列化しない
+ */
+void set_parallel_propagation(size_t number_of_workers, size_t threshold);
+
+/**
+ * root 以下の現在のスレッドのローカルなオブジェクト(フィールドに間接的に連なるものを含む)を全て共有されたものとして記録する
+ * 再帰呼び出しを使用せず、明示的な作業リストを使用して辿る
+ */
+void propagate_mutex(HeapObject* root);
+
+//ヘッダ情報ワード(header_info)の各ビットの割り当て
+//下位17ビットをフィールドの長さとし、残りのビットに各フラグとアロケータの番号、循環参照コレクタの作業用の情報を格納する
+#define HEADER_FIELD_LENGTH_MASK 0x0001FFFFu
+#define HEADER_GC_LIVE_BIT (1u << 17)
+#define HEADER_GC_DIRTY_BIT (1u << 18)
+#define HEADER_GC_ROOT_BIT (1u << 19)
+#define HEADER_LOCK_BIT (1u << 20)
+#define HEADER_CYCLIC_TYPE_BIT (1u << 21)
+#define HEADER_READY_TO_RELEASE_BIT (1u << 22)
+#define HEADER_BUFFERED_BIT (1u << 23)
+#define HEADER_OVERFLOW_COUNT_BIT (1u << 24)
+#define HEADER_ALLOCATOR_ID_SHIFT 25
+#define HEADER_ALLOCATOR_ID_MASK (0x7u << HEADER_ALLOCATOR_ID_SHIFT)
+#define HEADER_GC_COLOR_SHIFT 28
+#define HEADER_GC_COLOR_MASK (0x7u << HEADER_GC_COLOR_SHIFT)
+#define HEADER_GC_SCRATCH_BIT (1u << 31)
+
+//オブジェクトが持つことのできるフィールドの長さの最大値
+//これを超える長さはヘッダ情報ワードの他のビットを壊すため、alloc_heap_object で拒否する
+//ヘッダ情報ワードのビットを新たに割り当てる場合も、この値が想定するオブジェクトの大きさを下回らないようにする
+#define HEAP_OBJECT_MAX_FIELD_LENGTH HEADER_FIELD_LENGTH_MASK
+static_assert(HEAP_OBJECT_MAX_FIELD_LENGTH >= 0xFFFFu, "HeapObject must be able to hold at least 65535 fields");
+
+//参照カウントがこの値に達した場合、RC_OVERFLOW_AMOUNT だけ退避用のテーブルへ移す
+#define RC_OVERFLOW_THRESHOLD (1u << 28)
+#define RC_OVERFLOW_AMOUNT (1u << 27)
+
+
 /**
  * オブジェクトのヘッダ部分
+ *
+ * ヘッダは16バイトであり、以下の3つで構成する。
+ * + 32ビットの参照カウントのワード(下位2ビットが is_mutex と biased モードのフラグ、上位30ビットが参照カウント)
+ * + フィールドの長さと全てのフラグ、アロケータの番号をまとめた32ビットのヘッダ情報ワード
+ * + local_stamp、biased_count と biased_owner_id、suspect_next が共有する64ビットの領域
+ * 参照カウントが30ビットに収まらなくなる場合は、一部を overflow_ref_counts へ退避させる。
+ *
+ * is_mutex は参照カウントと同じワードに置くことで、動的切り替え参照カウントのカウント操作が
+ * 一度の load で動作モードとカウントの両方を得られるようにしている。
+ *
+ * local_stamp は割り当てたスレッドとその時点での世代を表し、オブジェクトがローカル(単一のスレッドからしかアクセスされない)
+ * であるかどうかの判定に使用する。詳細は"dynamic_rc.hpp"を参照
+ * biased_count と biased_owner_id は biased モードでのみ使用し、local_stamp と同じ領域を共有する。詳細は"biased_rc.hpp"を参照
+ * ヘッダの後半8バイトは全てのオブジェクトが local_stamp として使用するため、biased モードを使用しなくてもヘッダは16バイトとなり、
+ * biased モードのために追加で必要となる領域は無い。
+ * suspect_next も循環参照疑惑のあるオブジェクトとして記録された後にのみ使用し、同じ領域を共有する。
+ * 記録されるのは共有されたことが記録済みの循環性のある型のみであり、そのようなオブジェクトは biased モードにならず、
+ * ポインタは LOCAL_STAMP_FLAG を持たないため、どのスレッドのローカルにもならない。
  */
 class HeapObject {
 
 public:
-    //参照カウント
-    size_t reference_count;
-    //フィールドの長さ
-    size_t field_length;
-    //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-    //詳細は"dynamic_rc_hpp"を参照
-    bool is_mutex;
-    //スピンロックに使用するためのフラグ
-    atomic_flag spin_lock_flag;
-
+    //参照カウントのワード
+    // + RC_MUTEX_BIT : このオブジェクトが共有されていることが記録済みであるかどうか
+    //                  詳細は"dynamic_rc_hpp"を参照
+    // + RC_BIASED_BIT : 所有スレッドのみが biased_count を使用する biased モードであるかどうか
+    //                   詳細は"biased_rc.hpp"を参照
+    // + 上位30ビット : 参照カウント
+    //                  実際の参照カウントは、この値と overflow_ref_counts へ退避された値の和となる
+    uint32_t reference_count;
+    //フィールドの長さと以下のフラグ、アロケータの番号をまとめたもの
+    // + HEADER_LOCK_BIT : スピンロックに使用するためのフラグ
     // >>> 循環参照コレクタ用付加情報
-    //このオブジェクトが循環性のある型かどうか
-    bool is_cyclic_type;
-    //CycleCollectorで回収するかどうか
-    atomic_bool ready_to_release_with_gc;
-    //循環参照のルートオブジェクトとして記録されているかどうか
-    atomic_bool buffered;
+    // + HEADER_CYCLIC_TYPE_BIT : このオブジェクトが循環性のある型かどうか
+    // + HEADER_READY_TO_RELEASE_BIT : CycleCollectorで回収するかどうか
+    // + HEADER_BUFFERED_BIT : 循環参照のルートオブジェクトとして記録されているかどうか
+    // >>> 参照カウントの退避用
+    // + HEADER_OVERFLOW_COUNT_BIT : 参照カウントを overflow_ref_counts へ退避したことがあるかどうか
+    // >>> 循環参照コレクタとの同期用(実行スレッドが立て、コレクタが消去する)
+    // + HEADER_GC_DIRTY_BIT : 着色されている間にフィールドが変更されたかどうか
+    // >>> 循環参照コレクタとの同期用(コレクタが立て、実行スレッドが消去する)
+    // + HEADER_GC_LIVE_BIT : 生存していると判定したルートオブジェクトから辿ったオブジェクトであるかどうか
+    // >>> 循環参照コレクタの作業用(コレクタのみが読み書きする)
+    // + HEADER_GC_ROOT_BIT : 実行中の回収でバッファから取り出したルートオブジェクトであるかどうか
+    // + HEADER_GC_COLOR_MASK : 調べているルートオブジェクトからの探索における色(0 は未着色)
+    // + HEADER_GC_SCRATCH_BIT : 試行削除後のカウントを local_stamp の領域に格納しているかどうか
+    atomic<uint32_t> header_info;
+    union {
+        //オブジェクトを割り当てたスレッドのローカルな世代番号
+        //現在のスレッドの current_local_stamp と一致する場合のみ、オブジェクトはそのスレッドのローカルである
+        uint64_t local_stamp;
+        struct {
+            //biased モードにおいて所有スレッドのみが read-modify-write を使わずに増減させる参照カウント
+            uint32_t biased_count;
+            //biased モードにおける所有スレッドの番号
+            uint32_t biased_owner_id;
+        };
+        //循環参照疑惑のあるオブジェクトのスタックにおける次のオブジェクト("cycle_collector.hpp"を参照)
+        HeapObject* suspect_next;
+    };
 
 
+    inline size_t get_field_length() {
+        return this->header_info.load(memory_order_relaxed) & HEADER_FIELD_LENGTH_MASK;
+    }
+
+    inline uint8_t get_allocator_id() {
+        return (this->header_info.load(memory_order_relaxed) & HEADER_ALLOCATOR_ID_MASK) >> HEADER_ALLOCATOR_ID_SHIFT;
+    }
+
+    inline bool is_mutex() {
+        return (this->load_count_word() & RC_MUTEX_BIT) != 0;
+    }
+
     /**
-     * このオブジェクト以下のオブジェクト(フィールドに間接的に連なる全てのオブジェクトを含む)の is_mutex を true に伝搬させる
-     * 詳細は"dynamic_rc_hpp"を参照
+     * このオブジェクトが現在のスレッドのローカルであるかどうか
+     * ローカルでないオブジェクトは複数のスレッドからアクセスされる可能性がある
      */
-    inline void to_mutex() {
-        //is_mutex が false である場合
-        if (!this->is_mutex) {
-            this->is_mutex = true;
-
-            auto field_length = this->field_length;
-            //フィールドの開始ポインタ
-            auto** field_start_ptr = (HeapObject**) (this + 1);
-
-            for (size_t field_index = 0; field_index < field_length; field_index++) {
-                //対象となるフィールドのポインタ
-                auto** field_ptr = field_start_ptr + field_index;
-                //フィールドの内容をロード
-                auto* field_object = *field_ptr;
-
-                if (field_object != nullptr) {
-                    //再帰的に呼び出し
-                    field_object->to_mutex();
+    inline bool is_local() {
+        //循環参照コレクタが作業用のカウントとして同時に書き換える可能性があるため、atomic な命令で読む
+        return ((atomic<uint64_t>*) &this->local_stamp)->load(memory_order_relaxed) == current_local_stamp;
+    }
+
+    /**
+     * is_mutex を変更する
+     * 他のスレッドによる参照カウントの操作と競合しても失われないよう atomic-read-modify-write で変更する
+     */
+    inline void set_mutex(bool is_mutex) {
+        if (is_mutex) {
+            this->atomic_ref_count()->fetch_or(RC_MUTEX_BIT, memory_order_relaxed);
+        } else {
+            this->atomic_ref_count()->fetch_and(~RC_MUTEX_BIT, memory_order_relaxed);
+        }
+    }
+
+    inline bool is_cyclic_type() {
+        return (this->header_info.load(memory_order_relaxed) & HEADER_CYCLIC_TYPE_BIT) != 0;
+    }
+
+    inline void set_cyclic_type() {
+        this->header_info.fetch_or(HEADER_CYCLIC_TYPE_BIT, memory_order_relaxed);
+    }
+
+    inline bool is_ready_to_release_with_gc() {
+        return (this->header_info.load(memory_order_acquire) & HEADER_READY_TO_RELEASE_BIT) != 0;
+    }
+
+    inline void mark_ready_to_release_with_gc() {
+        this->header_info.fetch_or(HEADER_READY_TO_RELEASE_BIT, memory_order_release);
+    }
+
+    inline bool is_buffered(memory_order order) {
+        return (this->header_info.load(order) & HEADER_BUFFERED_BIT) != 0;
+    }
+
+    /**
+     * 循環参照疑惑のあるオブジェクトのスタックにおける次のオブジェクトを取得
+     * 他のスレッドが local_stamp として同時に読む可能性があるため、atomic な命令で読み書きする
+     */
+    inline HeapObject* get_suspect_next() {
+        return ((atomic<HeapObject*>*) &this->suspect_next)->load(memory_order_relaxed);
+    }
+
+    inline void set_suspect_next(HeapObject* next) {
+        ((atomic<HeapObject*>*) &this->suspect_next)->store(next, memory_order_relaxed);
+    }
+
+    /**
+     * 循環参照コレクタの作業用の情報の読み書き
+     * 他のビットは実行スレッドが atomic-read-modify-write で変更するため、同じく atomic-read-modify-write で書き換える
+     */
+    inline bool is_gc_root() {
+        return (this->header_info.load(memory_order_relaxed) & HEADER_GC_ROOT_BIT) != 0;
+    }
+
+    inline void set_gc_root(bool is_root) {
+        if (is_root) {
+            this->header_info.fetch_or(HEADER_GC_ROOT_BIT, memory_order_relaxed);
+        } else {
+            this->header_info.fetch_and(~HEADER_GC_ROOT_BIT, memory_order_relaxed);
+        }
+    }
+
+    inline uint8_t get_gc_color() {
+        return (uint8_t) ((this->header_info.load(memory_order_relaxed) & HEADER_GC_COLOR_MASK) >> HEADER_GC_COLOR_SHIFT);
+    }
+
+    inline void set_gc_color(uint8_t color) {
+        //色を書き換えるのはコレクタのみであるため、現在の色との差分を一度の xor で反映できる
+        auto header_info = this->header_info.load(memory_order_relaxed);
+        auto difference = (header_info ^ ((uint32_t) color << HEADER_GC_COLOR_SHIFT)) & HEADER_GC_COLOR_MASK;
+        this->header_info.fetch_xor(difference, memory_order_relaxed);
+    }
+
+    /**
+     * 色が expected であれば desired に書き換え、書き換えたかどうかを返す
+     * 複数のワーカーが同じオブジェクトの色を同時に書き換える場合に使用する
+     */
+    inline bool compare_exchange_gc_color(uint8_t expected, uint8_t desired) {
+        auto header_info = this->header_info.load(memory_order_relaxed);
+        uint32_t new_header_info;
+        do {
+            if (((header_info & HEADER_GC_COLOR_MASK) >> HEADER_GC_COLOR_SHIFT) != expected) {
+                return false;
+            }
+            new_header_info = (header_info & ~HEADER_GC_COLOR_MASK) | ((uint32_t) desired << HEADER_GC_COLOR_SHIFT);
+        } while (!this->header_info.compare_exchange_weak(header_info, new_header_info, memory_order_relaxed));
+        return true;
+    }
+
+    /**
+     * 色を color に書き換え、フィールドが変更されたことの記録を消去する
+     * ロックを取らずに調べる際に使用し、以降に読むフィールドと mark_gc_dirty_if_traced が順序付けられるよう seq_cst で書き換える
+     */
+    inline void begin_gc_trace(uint8_t color) {
+        auto header_info = this->header_info.load(memory_order_relaxed);
+        uint32_t new_header_info;
+        do {
+            new_header_info = (header_info & ~(HEADER_GC_COLOR_MASK | HEADER_GC_DIRTY_BIT)) | ((uint32_t) color << HEADER_GC_COLOR_SHIFT);
+        } while (!this->header_info.compare_exchange_weak(header_info, new_header_info, memory_order_seq_cst, memory_order_relaxed));
+    }
+
+    /**
+     * 循環参照コレクタが調べている最中であれば、フィールドが変更されたことを記録する
+     * 実行スレッドがフィールドを変更した後、外したオブジェクトの参照カウントを減らす前に呼び出す
+     */
+    inline void mark_gc_dirty_if_traced() {
+        if (this->header_info.load(memory_order_seq_cst) & HEADER_GC_COLOR_MASK) [[unlikely]] {
+            this->header_info.fetch_or(HEADER_GC_DIRTY_BIT, memory_order_relaxed);
+        }
+    }
+
+    /**
+     * 生存していると判定しうるルートオブジェクトから辿ったことを記録する
+     * ロックを取らずに辿る場合に、以降に読むフィールドと try_clear_gc_live が順序付けられるよう seq_cst で書き換える
+     */
+    inline void mark_gc_live() {
+        this->header_info.fetch_or(HEADER_GC_LIVE_BIT, memory_order_seq_cst);
+    }
+
+    /**
+     * コレクタが辿ったことが記録されていれば消去し、消去したかどうかを返す
+     * 実行スレッドがフィールドを変更した後に呼び出す
+     */
+    inline bool try_clear_gc_live() {
+        if (this->header_info.load(memory_order_seq_cst) & HEADER_GC_LIVE_BIT) [[unlikely]] {
+            return (this->header_info.fetch_and(~HEADER_GC_LIVE_BIT, memory_order_relaxed) & HEADER_GC_LIVE_BIT) != 0;
+        }
+        return false;
+    }
+
+    inline bool is_gc_dirty() {
+        return (this->header_info.load(memory_order_relaxed) & HEADER_GC_DIRTY_BIT) != 0;
+    }
+
+    inline void clear_gc_dirty() {
+        this->header_info.fetch_and(~HEADER_GC_DIRTY_BIT, memory_order_relaxed);
+    }
+
+    inline bool has_gc_scratch() {
+        return (this->header_info.load(memory_order_relaxed) & HEADER_GC_SCRATCH_BIT) != 0;
+    }
+
+    inline void set_has_gc_scratch(bool has_scratch) {
+        if (has_scratch) {
+            this->header_info.fetch_or(HEADER_GC_SCRATCH_BIT, memory_order_relaxed);
+        } else {
+            this->header_info.fetch_and(~HEADER_GC_SCRATCH_BIT, memory_order_relaxed);
+        }
+    }
+
+    /**
+     * local_stamp の領域を循環参照コレクタの作業用に使用できるかどうか
+     * 共有されたことが記録済みで biased モードでなければ、以降 local_stamp が読まれるのはローカルであるかの比較のみとなる
+     * バッファに積まれている間は suspect_next として使用されるため、取り出したルートオブジェクトである場合に限る
+     */
+    inline bool can_use_gc_scratch() {
+        auto count_word = this->load_count_word();
+        if (!(count_word & RC_MUTEX_BIT) || (count_word & RC_BIASED_BIT)) {
+            return false;
+        }
+        auto header_info = this->header_info.load(memory_order_relaxed);
+        return !(header_info & HEADER_BUFFERED_BIT) || (header_info & HEADER_GC_ROOT_BIT);
+    }
+
+    /**
+     * local_stamp の領域に格納した作業用のカウントの読み書き
+     * 他のスレッドが local_stamp として同時に読む可能性があるため、LOCAL_STAMP_FLAG を持たず 0 でもない値として格納する
+     */
+    inline size_t load_gc_scratch() {
+        return (size_t) (((atomic<uint64_t>*) &this->local_stamp)->load(memory_order_relaxed) >> 1);
+    }
+
+    inline void store_gc_scratch(size_t count) {
+        ((atomic<uint64_t>*) &this->local_stamp)->store((((uint64_t) count << 1) | LOCAL_STAMP_SHARED) & ~LOCAL_STAMP_FLAG, memory_order_relaxed);
+    }
+
+    /**
+     * 格納した作業用のカウントを一つ減らす(複数のワーカーから同時に呼び出せる)
+     * カウントは1ビット左にずらして格納しているため、2を引けば最下位ビットは変化しない
+     */
+    inline void decrement_gc_scratch() {
+        ((atomic<uint64_t>*) &this->local_stamp)->fetch_sub(2, memory_order_relaxed);
+    }
+
+    /**
+     * 作業用に使用した local_stamp の領域を、どのスレッドのローカルでもない値に戻す
+     */
+    inline void clear_gc_scratch() {
+        ((atomic<uint64_t>*) &this->local_stamp)->store(LOCAL_STAMP_SHARED, memory_order_relaxed);
+    }
+
+    /**
+     * buffered を true に設定し、設定前の値が false であったかどうかを返す
+     */
+    inline bool try_mark_buffered() {
+        return (this->header_info.fetch_or(HEADER_BUFFERED_BIT, memory_order_relaxed) & HEADER_BUFFERED_BIT) == 0;
+    }
+
+
+    /**
+     * 参照カウントのワードから参照カウントを取り出す
+     */
+    static inline uint32_t count_of(uint32_t count_word) {
+        return count_word >> RC_COUNT_SHIFT;
+    }
+
+    /**
+     * 参照カウントのワードをロード
+     */
+    inline uint32_t load_count_word() {
+        return this->atomic_ref_count()->load(memory_order_relaxed);
+    }
+
+    /**
+     * 参照カウントが2以上であるかどうか(overflow_ref_counts へ退避したことがあれば常に true)
+     * 他のスレッドが同時に減らさない限り、一つ減らしても0にならないことがわかる
+     */
+    inline bool has_multiple_references() {
+        return count_of(this->load_count_word()) > 1 || (this->header_info.load(memory_order_relaxed) & HEADER_OVERFLOW_COUNT_BIT);
+    }
+
+    /**
+     * 通常の命令で参照カウントを一つ増やし、増やす前の参照カウントのワードを返す
+     */
+    inline uint32_t increment_ref_count() {
+        auto previous_count_word = this->reference_count;
+        this->reference_count = previous_count_word + RC_COUNT_ONE;
+        if (count_of(previous_count_word) + 1 == RC_OVERFLOW_THRESHOLD) [[unlikely]] {
+            this->spill_ref_count(false);
+        }
+        return previous_count_word;
+    }
+
+    /**
+     * atomic-read-modify-write により参照カウントを一つ増やし、増やす前の参照カウントのワードを返す
+     */
+    inline uint32_t increment_ref_count_atomic() {
+        auto previous_count_word = this->atomic_ref_count()->fetch_add(RC_COUNT_ONE, memory_order_relaxed);
+        if (count_of(previous_count_word) + 1 == RC_OVERFLOW_THRESHOLD) [[unlikely]] {
+            this->spill_ref_count(true);
+        }
+        return previous_count_word;
+    }
+
+    /**
+     * ローカルでないオブジェクトの参照カウントのワードをロードする
+     * 共有されたことがまだ記録されておらず、現在のスレッドが biased モードの所有スレッドになれる場合はここで切り替える
+     * 遅延して biased モードへ切り替えたスレッドが RC_BIASED_BIT より先に書き込んだ biased_owner_id が見えるよう acquire でロードする
+     */
+    inline uint32_t load_shared_count_word() {
+        auto count_word = this->atomic_ref_count()->load(memory_order_acquire);
+        if (!(count_word & RC_MUTEX_BIT) && biased_rc_enabled) [[unlikely]] {
+            count_word = this->try_set_biased_lazily(count_word);
+        }
+        return count_word;
+    }
+
+    /**
+     * ローカルであるかどうかに応じて参照カウントを一つ増やし、増やす前の参照カウントのワードを返す
+     * ローカルであれば一度の load と store、そうでなければ一度の load と atomic-read-modify-write となる
+     * biased モードの所有スレッドであれば biased_count を通常の命令で増やす
+     */
+    inline uint32_t increment_ref_count_dynamic() {
+        uint32_t previous_count_word;
+        if (this->is_local()) {
+            //ローカルなオブジェクトは他のスレッドから変更されることはない
+            //コンパイラが前後のカウント操作とまとめられるよう、通常の命令で操作する
+            previous_count_word = this->reference_count;
+            this->reference_count = previous_count_word + RC_COUNT_ONE;
+            if (count_of(previous_count_word) + 1 == RC_OVERFLOW_THRESHOLD) [[unlikely]] {
+                this->spill_ref_count(false);
+            }
+        } else {
+            previous_count_word = this->load_shared_count_word();
+            if ((previous_count_word & RC_BIASED_BIT) && this->is_biased_owner()) {
+                this->increment_biased_count();
+                return previous_count_word;
+            }
+            //共有されたことが記録されていなくても、増やす場合はそのまま atomic-read-modify-write を使用できる
+            previous_count_word = this->atomic_ref_count()->fetch_add(RC_COUNT_ONE, memory_order_relaxed);
+            if (count_of(previous_count_word) + 1 == RC_OVERFLOW_THRESHOLD) [[unlikely]] {
+                this->spill_ref_count(true);
+            }
+        }
+        return previous_count_word;
+    }
+
+    /**
+     * 参照カウントが0でない場合のみ atomic-read-modify-write により参照カウントを一つ増やし、増やせたかどうかを返す
+     * ロックを取らずにフィールドからロードした、既に解放処理が始まっている可能性のあるオブジェクトに対して使用する
+     */
+    inline bool try_increment_ref_count_atomic() {
+        auto count_word = this->load_count_word();
+        do {
+            if (count_of(count_word) == 0) {
+                return false;
+            }
+        } while (!this->atomic_ref_count()->compare_exchange_weak(count_word, count_word + RC_COUNT_ONE, memory_order_relaxed));
+        if (count_of(count_word) + 1 == RC_OVERFLOW_THRESHOLD) [[unlikely]] {
+            this->spill_ref_count(true);
+        }
+        return true;
+    }
+
+    /**
+     * ローカルでないオブジェクトが生存している場合のみ参照カウントを一つ増やし、増やせたかどうかを返す
+     * 増やせた場合は previous_count_word に増やす前の参照カウントのワードを格納する
+     * biased モードである間は biased_count により生存していることがわかるため、常に増やせる
+     */
+    inline bool try_increment_ref_count_nonlocal(uint32_t& previous_count_word) {
+        auto count_word = this->load_shared_count_word();
+        if ((count_word & RC_BIASED_BIT) && this->is_biased_owner()) {
+            this->increment_biased_count();
+            previous_count_word = count_word;
+            return true;
+        }
+        do {
+            if (!(count_word & RC_BIASED_BIT) && count_of(count_word) == 0) {
+                return false;
+            }
+        } while (!this->atomic_ref_count()->compare_exchange_weak(count_word, count_word + RC_COUNT_ONE, memory_order_relaxed));
+        if (count_of(count_word) + 1 == RC_OVERFLOW_THRESHOLD) [[unlikely]] {
+            this->spill_ref_count(true);
+        }
+        previous_count_word = count_word;
+        return true;
+    }
+
+    /**
+     * 通常の命令で参照カウントを一つ減らし、0になったかどうかを返す
+     */
+    inline bool decrement_ref_count() {
+        return this->decrement_ref_count_local(this->reference_count);
+    }
+
+    /**
+     * 予めロードした参照カウントのワードを使用して、通常の命令で参照カウントを一つ減らし、0になったかどうかを返す
+     */
+    inline bool decrement_ref_count_local(uint32_t count_word) {
+        this->reference_count = count_word - RC_COUNT_ONE;
+        if (count_of(count_word) != 1) {
+            return false;
+        }
+        if (!(this->header_info.load(memory_order_relaxed) & HEADER_OVERFLOW_COUNT_BIT)) [[likely]] {
+            return true;
+        }
+        return !this->refill_ref_count(false);
+    }
+
+    /**
+     * atomic-read-modify-write により参照カウントを一つ減らし、0になったかどうかを返す
+     * 0になった場合、他のスレッド上での変更の取得(acquire)は呼び出し側で行う
+     */
+    inline bool decrement_ref_count_atomic() {
+        auto previous_count_word = this->atomic_ref_count()->fetch_sub(RC_COUNT_ONE, memory_order_release);
+        if (count_of(previous_count_word) != 1) {
+            return false;
+        }
+        if (!(this->header_info.load(memory_order_relaxed) & HEADER_OVERFLOW_COUNT_BIT)) [[likely]] {
+            return true;
+        }
+        return !this->refill_ref_count(true);
+    }
+
+    /**
+     * ローカルでないオブジェクトの参照カウントを一つ減らし、0になったかどうかを返す
+     * 0になった場合、他のスレッド上での変更の取得(acquire)は呼び出し側で行う
+     */
+    inline bool decrement_ref_count_nonlocal() {
+        auto count_word = this->load_shared_count_word();
+        //共有されたことが記録されていない間は、所有スレッドが biased モードへ切り替える可能性があるため CAS で減らす
+        while (!(count_word & RC_MUTEX_BIT)) [[unlikely]] {
+            if (this->atomic_ref_count()->compare_exchange_weak(count_word, count_word - RC_COUNT_ONE, memory_order_release, memory_order_relaxed)) {
+                if (count_of(count_word) != 1) {
+                    return false;
+                }
+                if (!(this->header_info.load(memory_order_relaxed) & HEADER_OVERFLOW_COUNT_BIT)) {
+                    return true;
+                }
+                return !this->refill_ref_count(true);
+            }
+        }
+        return this->decrement_ref_count_shared(count_word);
+    }
+
+    /**
+     * is_mutex が true であるオブジェクトの参照カウントを一つ減らし、0になったかどうかを返す
+     * biased モードである場合はその規則に従って減らす
+     * 0になった場合、他のスレッド上での変更の取得(acquire)は呼び出し側で行う
+     */
+    inline bool decrement_ref_count_shared(uint32_t count_word) {
+        if (count_word & RC_BIASED_BIT) {
+            if (this->is_biased_owner()) {
+                //所有スレッドである場合、biased_count を read-modify-write を使わずに減らす
+                auto biased_count = this->load_biased_count() - 1;
+                this->store_biased_count(biased_count);
+                if (biased_count != 0) {
+                    return false;
                 }
+                //0になれば biased モードを解除する
+                return this->merge_biased_count();
             }
+            return this->decrement_ref_count_biased_slow();
         }
+        return this->decrement_ref_count_atomic();
     }
 
 
     /**
-     * spin_lock_flag を使用してスピンロック(lock)
+     * 現在のスレッドが biased モードの所有スレッドであるかどうか
+     */
+    inline bool is_biased_owner() {
+        return this->load_biased_owner_id() == current_biased_thread_id;
+    }
+
+    /**
+     * biased モードの所有スレッドの番号を取得
+     * 他のスレッドが local_stamp として同時に読み書きする可能性があるため、atomic な命令で読む
+     * RC_BIASED_BIT を load_shared_count_word で読んだ後に呼び出す
+     */
+    inline uint32_t load_biased_owner_id() {
+        return ((atomic<uint32_t>*) &this->biased_owner_id)->load(memory_order_relaxed);
+    }
+
+    /**
+     * ローカルなオブジェクトを、owner_id のスレッドを所有スレッドとする biased モードへ切り替える
+     * それまでの参照カウントは全て biased_count へ移す
+     */
+    inline void set_biased(uint32_t owner_id) {
+        this->biased_count = count_of(this->reference_count);
+        this->biased_owner_id = owner_id;
+        this->reference_count = (this->reference_count & ~(~0u << RC_COUNT_SHIFT)) | RC_MUTEX_BIT | RC_BIASED_BIT;
+    }
+
+    /**
+     * ローカルなオブジェクトを共有されたものとして記録し、どのスレッドのローカルでもなくする
+     */
+    inline void set_shared() {
+        if (biased_rc_enabled && !this->is_cyclic_type()) {
+            //biased モードが有効であれば、共有するスレッドを所有スレッドとする
+            this->set_biased(get_biased_thread_id());
+        } else {
+            this->set_mutex(true);
+            ((atomic<uint64_t>*) &this->local_stamp)->store(LOCAL_STAMP_SHARED, memory_order_relaxed);
+        }
+    }
+
+    /**
+     * 所有スレッドが biased_count を一つ増やす
+     */
+    inline void increment_biased_count() {
+        auto biased_count = this->load_biased_count() + 1;
+        this->store_biased_count(biased_count);
+        if (biased_count == RC_OVERFLOW_THRESHOLD) [[unlikely]] {
+            this->spill_biased_count();
+        }
+    }
+
+    /**
+     * biased_count の読み書き
+     * 書き換えるのは所有スレッドのみであるが、load_ref_count により他のスレッドが同時に読むため atomic な命令で読み書きする
+     * 所有スレッドのみが書き換えるため read-modify-write は必要なく、通常の load と store と同じ命令となる
+     */
+    inline uint32_t load_biased_count() {
+        return ((atomic<uint32_t>*) &this->biased_count)->load(memory_order_relaxed);
+    }
+
+    inline void store_biased_count(uint32_t biased_count) {
+        ((atomic<uint32_t>*) &this->biased_count)->store(biased_count, memory_order_relaxed);
+    }
+
+    /**
+     * 退避された値を含めた参照カウントを取得
+     */
+    size_t load_ref_count();
+
+    inline atomic<uint32_t>* atomic_ref_count() {
+        return (atomic<uint32_t>*) &this->reference_count;
+    }
+
+private:
+    /**
+     * 参照カウントの一部を overflow_ref_counts へ退避させる
+     */
+    void spill_ref_count(bool is_atomic);
+
+    /**
+     * overflow_ref_counts へ退避させた参照カウントを戻す
+     * 戻すことができた場合、若しくは他のスレッドが既に参照カウントを増やしていた場合は true を返す
+     */
+    bool refill_ref_count(bool is_atomic);
+
+    /**
+     * biased_count の一部を overflow_ref_counts へ退避させる
+     */
+    void spill_biased_count();
+
+    /**
+     * 所有スレッドの biased_count が0になった際に biased モードを解除し、参照カウントが0になったかどうかを返す
+     */
+    bool merge_biased_count();
+
+    /**
+     * 所有スレッド以外から biased モードのオブジェクトの参照カウントを一つ減らし、0になったかどうかを返す
+     */
+    bool decrement_ref_count_biased_slow();
+
+    /**
+     * ローカルでなくなったが共有されたことが記録されていないオブジェクトを、
+     * 現在のスレッドが割り当てたものであれば biased モードへ切り替え、参照カウントのワードを返す
+     */
+    uint32_t try_set_biased_lazily(uint32_t count_word);
+
+public:
+
+    /**
+     * このオブジェクト以下のオブジェクト(フィールドに間接的に連なる全てのオブジェクトを含む)を複数のスレッドからアクセスされうるものとする
+     * このオブジェクト自身を共有されたものとして記録し、現在のスレッドの世代を進めることで
+     * それ以前に割り当てた全てのオブジェクトをローカルでなくする(フィールドは辿らない)
+     * eager_mutex_propagation が true である場合(既定)、若しくは世代を使い切っている場合は propagate_mutex により即座に伝搬させる
+     *
+     * 世代を進めると、このスレッドが手元に残している共有していないオブジェクトも以降は atomic な命令で参照カウントを操作することになる。
+     * 多くのローカルなオブジェクトを保持したまま共有を繰り返すスレッドでは、伝搬させる部分グラフが小さければ
+     * 即座に伝搬させた方が速いため、世代を進めるのは eager_mutex_propagation を false にしたスレッドのみとする
+     * (benchmark_walk_tree_after_publish で比較できる)
+     * 詳細は"dynamic_rc_hpp"を参照
+     */
+    inline void to_mutex() {
+        if (!this->is_local()) {
+            //既にローカルでない場合は何もしない
+            return;
+        }
+
+        if (eager_mutex_propagation || !advance_local_stamp()) [[unlikely]] {
+            propagate_mutex(this);
+            return;
+        }
+
+        this->set_shared();
+    }
+
+
+    /**
+     * header_info の HEADER_LOCK_BIT を使用してスピンロック(lock)
      */
     inline void lock() {
-        while (this->spin_lock_flag.test_and_set(memory_order_acquire)) {
+        while (this->header_info.fetch_or(HEADER_LOCK_BIT, memory_order_acquire) & HEADER_LOCK_BIT) {
             //spin
         }
     }
 
     /**
-     * spin_lock_flag を使用してスピンロック(unlock)
+     * header_info の HEADER_LOCK_BIT を使用してスピンロック(待たずに取得を試みる)
+     */
+    inline bool try_lock() {
+        return (this->header_info.fetch_or(HEADER_LOCK_BIT, memory_order_acquire) & HEADER_LOCK_BIT) == 0;
+    }
+
+    /**
+     * header_info の HEADER_LOCK_BIT を使用してスピンロック(unlock)
      */
     inline void unlock() {
-        this->spin_lock_flag.clear(memory_order_release);
+        this->header_info.fetch_and(~HEADER_LOCK_BIT, memory_order_release);
     }
 
     inline void print_inner(unordered_set<HeapObject*>& objects) {
@@ -95,17 +775,12 @@ public:
 
         objects.insert(this);
 
-        size_t ref_count;
-        if (this->is_mutex) {
-            ref_count = ((atomic_size_t*) &this->reference_count)->load(memory_order_relaxed);
-        } else {
-            ref_count = this->reference_count;
-        }
+        auto ref_count = this->load_ref_count();
 
         cout << this << " | ref_count : " << ref_count << " | ";
         
         auto** fields = (HeapObject**) (this + 1);
-        auto field_length = this->field_length;
+        auto field_length = this->get_field_length();
         vector<HeapObject*> field_objects;
 
         for (size_t i = 0; i < field_length; i++) {
@@ -129,15 +804,41 @@ public:
     }
 };
 
+//小さなオブジェクトのヘッダがフィールドより大きくならないようにする
+//前半8バイトが参照カウントとヘッダ情報、後半8バイトが local_stamp とそれを共有する biased モード等の情報である
+static_assert(sizeof(HeapObject) <= 16, "HeapObject header must fit in 16 bytes");
+
+
+/**
+ * フィールドの長さが HEAP_OBJECT_MAX_FIELD_LENGTH を超える場合にプロセスを終了させる
+ */
+[[noreturn]] void fail_field_length_too_large(size_t field_length);
 
 /**
  * オブジェクトをヒープ領域に割り当て
+ * field_length は HEAP_OBJECT_MAX_FIELD_LENGTH 以下でなければならない
  */
 inline HeapObject* alloc_heap_object(size_t field_length) {
+    //ヘッダ情報ワードに収まらない長さは、フラグやアロケータの番号を黙って書き換えてしまうため受け付けない
+    if (field_length > HEAP_OBJECT_MAX_FIELD_LENGTH) [[unlikely]] {
+        fail_field_length_too_large(field_length);
+    }
+
+    //他のスレッドから biased_count の減算を依頼されていれば、割り当ての度に処理する
+    poll_biased_decrements();
+
     //確保するサイズ
     //HeapObject をヘッダとしてそれに連なる形でフィールドの領域も合わせて確保
     auto allocate_size = sizeof(HeapObject) + sizeof(HeapObject*) * field_length;
-    auto* object_ptr = (HeapObject*) malloc(allocate_size);
+
+    //既定のプールアロケータである場合は関数ポインタを経由せずに割り当てる
+    auto allocator_id = current_heap_allocator_id;
+    HeapObject* object_ptr;
+    if (allocator_id == POOL_HEAP_ALLOCATOR_ID) {
+        object_ptr = (HeapObject*) pool_allocate(field_length, allocate_size);
+    } else {
+        object_ptr = (HeapObject*) heap_allocators[allocator_id]->allocate(field_length, allocate_size);
+    }
     
     //各フィールドを初期化
     //フィールドの開始ポインタ
@@ -147,13 +848,15 @@ inline HeapObject* alloc_heap_object(size_t field_length) {
     }
 
     //ヘッダの各フィールドを初期化
-    object_ptr->is_mutex = false;
-    object_ptr->reference_count = 1;
-    object_ptr->field_length = field_length;
-    object_ptr->spin_lock_flag.clear();
-    object_ptr->is_cyclic_type = false;
-    object_ptr->ready_to_release_with_gc.store(false, memory_order_relaxed);
-    object_ptr->buffered.store(false, memory_order_relaxed);
+    //フィールドの長さ以外のフラグは全て false で初期化する
+    object_ptr->reference_count = RC_COUNT_ONE;
+    //割り当てたスレッドのローカルとする
+    auto local_stamp = current_local_stamp;
+    if (local_stamp == 0) [[unlikely]] {
+        local_stamp = init_local_stamp();
+    }
+    object_ptr->local_stamp = local_stamp;
+    object_ptr->header_info.store((uint32_t) field_length | ((uint32_t) allocator_id << HEADER_ALLOCATOR_ID_SHIFT), memory_order_relaxed);
     //((atomic_size_t*) &object_ptr->reference_count)->store(1, memory_order_release);
 
     #if RC_VALIDATION
@@ -162,4 +865,25 @@ inline HeapObject* alloc_heap_object(size_t field_length) {
     #endif
 
     return object_ptr;
+}
+
+
+/**
+ * オブジェクトをヒープ領域から解放
+ */
+inline void free_heap_object(HeapObject* object) {
+    //オブジェクトを割り当てたアロケータへ返却する
+    auto allocator_id = object->get_allocator_id();
+    auto field_length = object->get_field_length();
+    if (allocator_id == POOL_HEAP_ALLOCATOR_ID) {
+        //解放したブロックは割り当てたスレッドのプールへ返却される
+        pool_free(object, field_length);
+    } else {
+        heap_allocators[allocator_id]->release(object, field_length);
+    }
+
+    #if RC_VALIDATION
+        //生存しているオブジェクト数を一つ減らす
+        global_object_count.fetch_sub(1, memory_order_relaxed);
+    #endif
 }
\ No newline at end of file
@@ -59,7 +59,7 @@ public:
      * このオブジェクトとそのフィールドのオブジェクトを再帰的に削除
      */
     inline void detele_object() {
-        auto field_length = this->object_ref->field_length;
+        auto field_length = this->object_ref->get_field_length();
         //フィールドの開始ポインタ
         auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
 
@@ -74,13 +74,7 @@ public:
             }
         }
 
-        free(this->object_ref);
-
-
-        #if RC_VALIDATION
-            //生存しているオブジェクト数を一つ減らす
-            global_object_count.fetch_sub(1, memory_order_relaxed);
-        #endif
+        free_heap_object(this->object_ref);
     }
 
 };
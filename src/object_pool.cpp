@@ -0,0 +1,112 @@
+#include "object_pool.hpp"
+
+#include <iostream>
+
+
+thread_local ThreadLocalPool* current_thread_pool = nullptr;
+
+//放棄されたプールのリストとそのロック
+SpinLock abandoned_pool_lock{};
+ThreadLocalPool* abandoned_pools = nullptr;
+
+
+/**
+ * スレッドの終了時に、そのスレッドが使用していたプールを放棄されたプールとして記録する
+ */
+struct ThreadPoolGuard {
+    ThreadLocalPool* pool = nullptr;
+
+    ~ThreadPoolGuard() {
+        if (this->pool == nullptr) {
+            return;
+        }
+
+        //以降の解放は全て remote_free_list を経由させる
+        current_thread_pool = nullptr;
+
+        abandoned_pool_lock.lock();
+        this->pool->next_abandoned = abandoned_pools;
+        abandoned_pools = this->pool;
+        abandoned_pool_lock.unlock();
+    }
+};
+
+thread_local ThreadPoolGuard thread_pool_guard;
+
+
+/**
+ * 現在のスレッドにプールを割り当てる(放棄されたプールがあればそれを引き継ぐ)
+ */
+ThreadLocalPool* init_thread_pool() {
+    abandoned_pool_lock.lock();
+    auto* pool = abandoned_pools;
+    if (pool != nullptr) {
+        abandoned_pools = pool->next_abandoned;
+    }
+    abandoned_pool_lock.unlock();
+
+    if (pool == nullptr) {
+        //プールは生存中のオブジェクトを持つ可能性があるため、一度作成したら破棄しない
+        pool = new ThreadLocalPool();
+    }
+
+    current_thread_pool = pool;
+    thread_pool_guard.pool = pool;
+    return pool;
+}
+
+
+/**
+ * 領域を確保できなかった場合にプロセスを終了させる
+ */
+void fail_pool_out_of_memory(size_t allocate_size) {
+    cerr << "pool_allocate: failed to allocate " << allocate_size << " bytes" << endl;
+    abort();
+}
+
+
+/**
+ * 未使用ブロックのリストが空である場合の割り当て処理
+ */
+void* ThreadLocalPool::allocate_slow(size_t size_class, size_t block_size) {
+    //他のスレッドで解放されたブロックを回収
+    this->drain_remote_free_list();
+
+    auto* block = this->free_lists[size_class];
+    if (block != nullptr) {
+        this->free_lists[size_class] = block->next;
+        return block;
+    }
+
+    //未使用領域が足りなければ新しいチャンクを確保
+    if (this->bump_ptrs[size_class] == nullptr || this->bump_ptrs[size_class] + block_size > this->bump_ends[size_class]) {
+        auto* chunk = (PoolChunk*) aligned_alloc(POOL_CHUNK_SIZE, POOL_CHUNK_SIZE);
+        if (chunk == nullptr) [[unlikely]] {
+            fail_pool_out_of_memory(POOL_CHUNK_SIZE);
+        }
+        chunk->owner = this;
+        chunk->size_class = size_class;
+
+        this->bump_ptrs[size_class] = (char*) (chunk + 1);
+        this->bump_ends[size_class] = (char*) chunk + POOL_CHUNK_SIZE;
+    }
+
+    auto* ptr = this->bump_ptrs[size_class];
+    this->bump_ptrs[size_class] = ptr + block_size;
+    return ptr;
+}
+
+
+/**
+ * 他のスレッドで解放されたブロックをまとめて取得し、サイズクラス毎のリストへ振り分ける
+ */
+void ThreadLocalPool::drain_remote_free_list() {
+    //所有スレッドのみが一括で取り出すため ABA 問題は起こらない
+    auto* block = this->remote_free_list.exchange(nullptr, memory_order_acquire);
+
+    while (block != nullptr) {
+        auto* next = block->next;
+        this->free_local(block, get_pool_chunk(block)->size_class);
+        block = next;
+    }
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+
+#include "spin_lock.hpp"
+
+using namespace std;
+
+
+//プールから割り当てるフィールドの長さの最大値
+//これより長いフィールドを持つオブジェクトは malloc/free で直接管理する
+#define POOL_MAX_FIELD_LENGTH 16
+
+//プールがメモリを確保する単位(チャンク)のサイズ
+//チャンクはこのサイズでアラインされるため、ブロックのアドレスからチャンクのヘッダを逆算できる
+#define POOL_CHUNK_SIZE (64 * 1024)
+
+
+/**
+ * 未使用ブロックの連結リストの要素
+ * 解放されたオブジェクトの領域をそのまま再利用する
+ */
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+
+class ThreadLocalPool;
+
+
+/**
+ * チャンクの先頭に置かれるヘッダ
+ */
+struct PoolChunk {
+    //このチャンクを所有するプール
+    ThreadLocalPool* owner;
+    //このチャンクから切り出すブロックのサイズクラス(フィールドの長さ)
+    size_t size_class;
+};
+
+
+/**
+ * スレッド毎に保持される、サイズクラス(フィールドの長さ)毎に分離されたオブジェクトプール
+ *
+ * 所有スレッド上での割り当てと解放は同期処理を一切必要としない。
+ * 他のスレッドで解放されたブロックは所有プールの remote_free_list へ lock-free に積まれ、
+ * 所有スレッドのローカルなリストが空になった時にまとめて回収される。
+ * スレッドが終了してもプール自体は破棄せず、生存中のオブジェクトを残したまま放棄されたプールとして記録しておき、
+ * 新しく起動したスレッドがそれを引き継ぐ。
+ */
+class ThreadLocalPool {
+
+private:
+    //サイズクラス毎の未使用ブロックのリスト
+    FreeBlock* free_lists[POOL_MAX_FIELD_LENGTH + 1];
+    //サイズクラス毎の未使用領域の開始ポインタと終端ポインタ
+    char* bump_ptrs[POOL_MAX_FIELD_LENGTH + 1];
+    char* bump_ends[POOL_MAX_FIELD_LENGTH + 1];
+    //他のスレッドで解放されたブロックのリスト
+    atomic<FreeBlock*> remote_free_list;
+
+public:
+    //放棄されたプールのリストを繋ぐポインタ
+    ThreadLocalPool* next_abandoned;
+
+    ThreadLocalPool(): free_lists(), bump_ptrs(), bump_ends(), remote_free_list(nullptr), next_abandoned(nullptr) {}
+
+
+    /**
+     * 指定されたサイズクラスのブロックを一つ割り当てる
+     */
+    inline void* allocate(size_t size_class, size_t block_size) {
+        auto* block = this->free_lists[size_class];
+        if (block != nullptr) {
+            this->free_lists[size_class] = block->next;
+            return block;
+        }
+        return this->allocate_slow(size_class, block_size);
+    }
+
+    /**
+     * このプールが所有するブロックを所有スレッド上で解放する
+     */
+    inline void free_local(void* ptr, size_t size_class) {
+        auto* block = (FreeBlock*) ptr;
+        block->next = this->free_lists[size_class];
+        this->free_lists[size_class] = block;
+    }
+
+    /**
+     * このプールが所有するブロックを他のスレッドから解放する
+     */
+    inline void free_remote(void* ptr) {
+        auto* block = (FreeBlock*) ptr;
+        auto* head = this->remote_free_list.load(memory_order_relaxed);
+        do {
+            block->next = head;
+        } while (!this->remote_free_list.compare_exchange_weak(head, block, memory_order_release, memory_order_relaxed));
+    }
+
+private:
+    void* allocate_slow(size_t size_class, size_t block_size);
+
+    void drain_remote_free_list();
+
+};
+
+
+//現在のスレッドが使用しているプール
+extern thread_local ThreadLocalPool* current_thread_pool;
+
+/**
+ * 現在のスレッドにプールを割り当てる(放棄されたプールがあればそれを引き継ぐ)
+ */
+ThreadLocalPool* init_thread_pool();
+
+
+/**
+ * ブロックのアドレスからそれを含むチャンクのヘッダを取得
+ */
+inline PoolChunk* get_pool_chunk(void* ptr) {
+    return (PoolChunk*) ((uintptr_t) ptr & ~((uintptr_t) POOL_CHUNK_SIZE - 1));
+}
+
+
+/**
+ * 領域を確保できなかった場合にプロセスを終了させる
+ * alloc_heap_object は割り当ての失敗を呼び出し側へ伝えないため、nullptr を返さずにここで終了する
+ */
+[[noreturn]] void fail_pool_out_of_memory(size_t allocate_size);
+
+
+/**
+ * 指定されたサイズクラスのブロックをプールから割り当てる
+ */
+inline void* pool_allocate(size_t size_class, size_t block_size) {
+    if (size_class > POOL_MAX_FIELD_LENGTH) {
+        auto* ptr = malloc(block_size);
+        if (ptr == nullptr) [[unlikely]] {
+            fail_pool_out_of_memory(block_size);
+        }
+        return ptr;
+    }
+
+    auto* pool = current_thread_pool;
+    if (pool == nullptr) {
+        pool = init_thread_pool();
+    }
+    return pool->allocate(size_class, block_size);
+}
+
+
+/**
+ * プールから割り当てたブロックを解放する
+ * 所有スレッド以外から呼び出された場合は所有プールの remote_free_list へ返却する
+ */
+inline void pool_free(void* ptr, size_t size_class) {
+    if (size_class > POOL_MAX_FIELD_LENGTH) {
+        free(ptr);
+        return;
+    }
+
+    auto* owner = get_pool_chunk(ptr)->owner;
+    if (owner == current_thread_pool) {
+        owner->free_local(ptr, size_class);
+    } else {
+        owner->free_remote(ptr);
+    }
+}
@@ -20,11 +20,47 @@ public:
     /**
      * コピーコンストラクタ
      * コピー時に参照カウントを一つ増やす
+     * ムーブ済み(空)のハンドルをコピーした場合は、空のハンドルとなる
      */
     inline SingleThreadRC(const SingleThreadRC& rc) {
         auto* object_ref = rc.object_ref;
-        object_ref->reference_count++;
         this->object_ref = object_ref;
+        if (object_ref == nullptr) [[unlikely]] {
+            return;
+        }
+        object_ref->increment_ref_count();
+    }
+
+    /**
+     * ムーブコンストラクタ
+     * 所有権を移すだけなので参照カウントは変更しない
+     * ムーブ元は空(nullptr)となり、デストラクタでは何もしない
+     * 空のハンドルに対して行えるのは破棄、代入、コピー(空のハンドルとなる)のみであり、
+     * get_object や set_object などのオブジェクトを操作する関数を呼び出してはならない
+     */
+    inline SingleThreadRC(SingleThreadRC&& rc) noexcept {
+        this->object_ref = rc.object_ref;
+        rc.object_ref = nullptr;
+    }
+
+    /**
+     * コピー代入演算子
+     */
+    inline SingleThreadRC& operator=(const SingleThreadRC& rc) {
+        SingleThreadRC copy(rc);
+        swap(this->object_ref, copy.object_ref);
+        return *this;
+    }
+
+    /**
+     * ムーブ代入演算子
+     * ムーブ元のオブジェクトの所有権を受け取り、ムーブ元は空(nullptr)となる
+     * 元々保持していたオブジェクトの参照カウントは、デストラクタと同じ処理でこの場で一つ減らす
+     */
+    inline SingleThreadRC& operator=(SingleThreadRC&& rc) noexcept {
+        SingleThreadRC moved(std::move(rc));
+        swap(this->object_ref, moved.object_ref);
+        return *this;
     }
 
     /**
@@ -32,12 +68,15 @@ public:
      * 呼び出される度に参照カウントを一つ減らす
      */
     inline ~SingleThreadRC() {
-        //参照カウントを一つ減らす
-        size_t previous_ref_count = this->object_ref->reference_count--;
+        //ムーブ済みの場合は何もしない
+        if (this->object_ref == nullptr) {
+            return;
+        }
 
+        //参照カウントを一つ減らす
         //減らした結果が0であれば削除処理を実行
-        if (previous_ref_count == 1) {
-            auto field_length = this->object_ref->field_length;
+        if (this->object_ref->decrement_ref_count()) {
+            auto field_length = this->object_ref->get_field_length();
             //フィールドの開始ポインタ
             auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
 
@@ -54,38 +93,54 @@ public:
                 }
             }
 
-            free(this->object_ref);
-
-
-            #if RC_VALIDATION
-                //生存しているオブジェクト数を一つ減らす
-                global_object_count.fetch_sub(1, memory_order_relaxed);
-            #endif
+            free_heap_object(this->object_ref);
         }
     }
 
 
     /**
      * 指定された番号のフィールドにオブジェクト若くは nullptr を挿入
+     * rc は値渡しで受け取った時点で参照カウントが確保されているため、その所有権をそのままフィールドへ移す
      */
     inline void set_object(size_t field_index, optional<SingleThreadRC> rc) {
         //rc が nullopt であれば nullptr
-        //そうでなければオブジェクトへのポインタを取得
+        //そうでなければオブジェクトの所有権を rc から引き継ぐ
         HeapObject* object = nullptr;
         if (rc.has_value()) {
-            object = rc.value().object_ref;
+            object = rc.value().release();
         }
 
+        this->set_object_owned(field_index, object);
+    }
+
+    /**
+     * 指定された番号のフィールドにオブジェクトを挿入
+     * 右辺値から所有権を引き継ぐため、参照カウントの変更を一切行わない
+     */
+    inline void set_object(size_t field_index, SingleThreadRC&& rc) {
+        this->set_object_owned(field_index, rc.release());
+    }
+
+    /**
+     * 保持しているオブジェクトの所有権を放棄してポインタを返す
+     * 参照カウントは変更しないため、呼び出し側が一つ分の参照カウントを引き継ぐ
+     */
+    inline HeapObject* release() {
+        auto* object_ref = this->object_ref;
+        this->object_ref = nullptr;
+        return object_ref;
+    }
+
+private:
+    /**
+     * 指定された番号のフィールドに、呼び出し側が参照カウントを一つ分確保したオブジェクト若くは nullptr を挿入
+     */
+    inline void set_object_owned(size_t field_index, HeapObject* object) {
         //フィールドの開始ポインタ
         auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
         //対象となるフィールドのポインタ
         auto** field_ptr = field_start_ptr + field_index;
 
-        if (object != nullptr) {
-            //参照カウントを一つ増やす
-            object->reference_count++;
-        }
-        
         //フィールド内へ既に挿入されているオブジェクトを取得
         auto* field_old_object = *field_ptr;
         //フィールドへ挿入
@@ -97,6 +152,7 @@ public:
         }
     }
 
+public:
 
     /**
      * 指定された番号のフィールドにあるオブジェクトを取得
@@ -111,7 +167,7 @@ public:
         auto* field_object = *field_ptr;
         if (field_object != nullptr) {
             //参照カウントを一つ増やす
-            field_object->reference_count++;
+            field_object->increment_ref_count();
         }
 
         if (field_object == nullptr) {
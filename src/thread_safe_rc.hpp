@@ -1,6 +1,7 @@
 #pragma once
 
 #include "heap_object.hpp"
+#include "epoch_reclamation.hpp"
 
 
 /**
@@ -27,14 +28,50 @@ public:
     /**
      * コピーコンストラクタ
      * コピー時に参照カウントを一つ増やす
+     * ムーブ済み(空)のハンドルをコピーした場合は、空のハンドルとなる
      */
     inline ThreadSafeRC(const ThreadSafeRC& rc) {
         auto* object_ref = rc.object_ref;
-        //atomic_size_t として参照カウントを一つ増やす
-        //オブジェクト作成時の参照カウントの設定は atomic_size_t で行っていないが、恐らく上手く動作する(?)
-        //少なくとも AArch64 では上手く動作しているように見える
-        ((atomic_size_t*) &object_ref->reference_count)->fetch_add(1, memory_order_relaxed);
         this->object_ref = object_ref;
+        if (object_ref == nullptr) [[unlikely]] {
+            return;
+        }
+        //atomic-read-modify-write により参照カウントを一つ増やす
+        //オブジェクト作成時の参照カウントの設定は atomic な命令で行っていないが、恐らく上手く動作する(?)
+        //少なくとも AArch64 では上手く動作しているように見える
+        object_ref->increment_ref_count_atomic();
+    }
+
+    /**
+     * ムーブコンストラクタ
+     * 所有権を移すだけなので参照カウントは変更しない
+     * ムーブ元は空(nullptr)となり、デストラクタでは何もしない
+     * 空のハンドルに対して行えるのは破棄、代入、コピー(空のハンドルとなる)のみであり、
+     * get_object や set_object などのオブジェクトを操作する関数を呼び出してはならない
+     */
+    inline ThreadSafeRC(ThreadSafeRC&& rc) noexcept {
+        this->object_ref = rc.object_ref;
+        rc.object_ref = nullptr;
+    }
+
+    /**
+     * コピー代入演算子
+     */
+    inline ThreadSafeRC& operator=(const ThreadSafeRC& rc) {
+        ThreadSafeRC copy(rc);
+        swap(this->object_ref, copy.object_ref);
+        return *this;
+    }
+
+    /**
+     * ムーブ代入演算子
+     * ムーブ元のオブジェクトの所有権を受け取り、ムーブ元は空(nullptr)となる
+     * 元々保持していたオブジェクトの参照カウントは、デストラクタと同じ処理でこの場で一つ減らす
+     */
+    inline ThreadSafeRC& operator=(ThreadSafeRC&& rc) noexcept {
+        ThreadSafeRC moved(std::move(rc));
+        swap(this->object_ref, moved.object_ref);
+        return *this;
     }
 
     /**
@@ -42,12 +79,16 @@ public:
      * 呼び出される度に参照カウントを一つ減らす
      */
     inline ~ThreadSafeRC() {
+        //ムーブ済みの場合は何もしない
+        if (this->object_ref == nullptr) {
+            return;
+        }
+
         //参照カウントを一つ減らす
         //安全性の詳細については以下を参照
         // + https://github.com/rust-lang/rust/blob/master/library/alloc/src/sync.rs
         // + https://www.boost.org/doc/libs/1_55_0/doc/html/atomic/usage_examples.html
-        size_t previous_ref_count = ((atomic_size_t*) &this->object_ref->reference_count)->fetch_sub(1, memory_order_release);
-        if (previous_ref_count != 1) {
+        if (!this->object_ref->decrement_ref_count_atomic()) {
             //減らした後の参照カウントが0でない場合は何もしない
             return;
         }
@@ -55,7 +96,7 @@ public:
         //他のスレッドでの変更を取得
         atomic_thread_fence(memory_order_acquire);
 
-        auto field_length = this->object_ref->field_length;
+        auto field_length = this->object_ref->get_field_length();
         //フィールドの開始ポインタ
         auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
 
@@ -72,60 +113,73 @@ public:
             }
         }
 
-        free(this->object_ref);
-
-
-        #if RC_VALIDATION
-            //生存しているオブジェクト数を一つ減らす
-            global_object_count.fetch_sub(1, memory_order_relaxed);
-        #endif
+        //ロックを取らずにフィールドを読んでいる他のスレッドがロードしている可能性がある場合のみ、解放を遅らせる
+        retire_or_free_heap_object(this->object_ref);
     }
 
 
     /**
-     * オブジェクトの spin_lock_flag を使用してスピンロック(lock)
+     * オブジェクトのヘッダを使用してスピンロック(lock)
      */
     inline void lock() {
-        while (this->object_ref->spin_lock_flag.test_and_set(memory_order_acquire)) {
-            //spin
-        }
+        this->object_ref->lock();
     }
 
     /**
-     * オブジェクトの spin_lock_flag を使用してスピンロック(unlock)
+     * オブジェクトのヘッダを使用してスピンロック(unlock)
      */
     inline void unlock() {
-        this->object_ref->spin_lock_flag.clear(memory_order_release);
+        this->object_ref->unlock();
     }
 
 
 
     /**
      * 指定された番号のフィールドにオブジェクト若くは nullptr を挿入
+     * rc は値渡しで受け取った時点で参照カウントが確保されているため、その所有権をそのままフィールドへ移す
      */
     inline void set_object(size_t field_index, optional<ThreadSafeRC> rc) {
         //rc が nullopt であれば nullptr
-        //そうでなければオブジェクトへのポインタを取得
+        //そうでなければオブジェクトの所有権を rc から引き継ぐ
         HeapObject* object = nullptr;
         if (rc.has_value()) {
-            object = rc.value().object_ref;
+            object = rc.value().release();
         }
 
+        this->set_object_owned(field_index, object);
+    }
+
+    /**
+     * 指定された番号のフィールドにオブジェクトを挿入
+     * 右辺値から所有権を引き継ぐため、参照カウントの変更を一切行わない
+     */
+    inline void set_object(size_t field_index, ThreadSafeRC&& rc) {
+        this->set_object_owned(field_index, rc.release());
+    }
+
+    /**
+     * 保持しているオブジェクトの所有権を放棄してポインタを返す
+     * 参照カウントは変更しないため、呼び出し側が一つ分の参照カウントを引き継ぐ
+     */
+    inline HeapObject* release() {
+        auto* object_ref = this->object_ref;
+        this->object_ref = nullptr;
+        return object_ref;
+    }
+
+private:
+    /**
+     * 指定された番号のフィールドに、呼び出し側が参照カウントを一つ分確保したオブジェクト若くは nullptr を挿入
+     */
+    inline void set_object_owned(size_t field_index, HeapObject* object) {
         //フィールドの開始ポインタ
         auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
         //対象となるフィールドのポインタ
         auto** field_ptr = field_start_ptr + field_index;
 
-        if (object != nullptr) {
-            //参照カウントを一つ増やす
-            ((atomic_size_t*) &object->reference_count)->fetch_add(1, memory_order_relaxed);
-        }
-        
-        //スピンロックを使用してフィールドのオブジェクトを不可分的に入れ替える
-        this->lock();
-        auto* field_old_object = *field_ptr;
-        *field_ptr = object;
-        this->unlock();
+        //atomic な交換によりフィールドのオブジェクトを入れ替える
+        //外したオブジェクトを直ちに解放してよいかの判定(retire_or_free_heap_object)のため seq_cst で交換する
+        auto* field_old_object = ((atomic<HeapObject*>*) field_ptr)->exchange(object, memory_order_seq_cst);
 
         if (field_old_object != nullptr) {
             //デストラクタを呼び出し、既に挿入されていたオブジェクトの参照カウントを一つ減らす
@@ -133,6 +187,7 @@ public:
         }
     }
 
+public:
 
     /**
      * 指定された番号のフィールドにあるオブジェクトを取得
@@ -143,16 +198,17 @@ public:
         //対象となるフィールドのポインタ
         auto** field_ptr = field_start_ptr + field_index;
 
-        //スピンロックを使用して以下の操作を不可分的に行う
-        // 1. フィールドからロード
-        // 2. ロードしたオブジェクトの参照カウントを一つ増やす
-        this->lock();
-        auto* field_object = *field_ptr;
-        if (field_object != nullptr) {
-            ((atomic_size_t*) &field_object->reference_count)->fetch_add(1, memory_order_relaxed);
+        //ロックを取らずにロードし、参照カウントが0でない場合のみ一つ増やす
+        //ロードしてから増やすまでの間に解放されたオブジェクトの領域は、エポックにより再利用されずに残っている
+        //参照カウントが既に0であれば、他のスレッドがフィールドを書き換えて解放しようとしているため読み直す
+        auto* field_atomic = (atomic<HeapObject*>*) field_ptr;
+        HeapObject* field_object;
+        {
+            EpochGuard epoch_guard;
+            do {
+                field_object = field_atomic->load(memory_order_acquire);
+            } while (field_object != nullptr && !field_object->try_increment_ref_count_atomic());
         }
-        this->unlock();
-
         if (field_object == nullptr) {
             return nullopt;
         } else {